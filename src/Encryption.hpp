@@ -9,6 +9,7 @@
 #include <optional>
 #include <iostream>
 #include <array>
+#include <future>
 #include <sodium.h>
 
 // Single Header file that can be used to add encryption to a lossy unidirectional link
@@ -19,11 +20,92 @@
 // create deterministic rx and tx keys
 static const std::array<unsigned char,crypto_box_SEEDBYTES> DEFAULT_ENCRYPTION_SEED={0};
 
+// Selected by the tx and announced in the session key packet.
+// AUTHENTICATE_ONLY: The payload is sent in plain text, but packet validation (e.g. only accepting data from the tx) is kept.
+// Cheaper than encryption and authentication, for data where confidentiality doesn't matter (e.g. a public video feed)
+enum class EncryptionMode:uint8_t{
+    ENCRYPT_AND_AUTHENTICATE=0,
+    AUTHENTICATE_ONLY=1
+};
+static bool isValidEncryptionMode(const uint8_t mode){
+    return mode==(uint8_t)EncryptionMode::ENCRYPT_AND_AUTHENTICATE || mode==(uint8_t)EncryptionMode::AUTHENTICATE_ONLY;
+}
+
+// AEAD cipher used for ENCRYPT_AND_AUTHENTICATE, selected by the tx and announced in the session key packet.
+// AES256GCM is much faster on CPUs with AES instructions (AES-NI, ARMv8 crypto extensions), but libsodium
+// only supports it on these CPUs - so it has to be available on both the tx and the rx.
+enum class Cipher:uint8_t{
+    CHACHA20_POLY1305=0,
+    AES256GCM=1
+};
+static void initializeSodium(){
+    // can be called multiple times, but has to be called before checking if AES256GCM is available
+    if(sodium_init()<0){
+        throw std::runtime_error("Unable to initialize libsodium");
+    }
+}
+static bool isCipherAvailable(const uint8_t cipher){
+    initializeSodium();
+    switch (cipher) {
+        case (uint8_t)Cipher::CHACHA20_POLY1305:return true;
+        case (uint8_t)Cipher::AES256GCM:return crypto_aead_aes256gcm_is_available()!=0;
+        default:return false;
+    }
+}
+// returns @param preferred if it is available on this CPU, CHACHA20_POLY1305 otherwise
+static Cipher selectCipher(const Cipher preferred){
+    if(isCipherAvailable((uint8_t)preferred)){
+        return preferred;
+    }
+    std::cerr<<"Cipher "<<(int)preferred<<" is not available on this CPU, using CHACHA20_POLY1305\n";
+    return Cipher::CHACHA20_POLY1305;
+}
+static_assert(crypto_aead_aes256gcm_KEYBYTES==crypto_aead_chacha20poly1305_KEYBYTES,"Both ciphers use the same session key");
+static_assert(crypto_aead_aes256gcm_ABYTES==crypto_aead_chacha20poly1305_ABYTES,"Same packet layout for both ciphers");
+// AES256GCM uses a 96 bit nonce, the upper 32 bits are always zero.
+static std::array<uint8_t,crypto_aead_aes256gcm_NPUBBYTES> toAES256GCMNonce(const uint64_t nonce){
+    std::array<uint8_t,crypto_aead_aes256gcm_NPUBBYTES> ret{};
+    memcpy(ret.data(),&nonce,sizeof(nonce));
+    return ret;
+}
+
+// Poly1305 tag over the header (@param ad) and the payload for AUTHENTICATE_ONLY mode. The one-time key is derived from the session key and the nonce
+// the same way crypto_aead_chacha20poly1305 does (first 32 bytes of the ChaCha20 key stream), such that each packet uses a different key.
+static void calculateAuthenticationTag(const std::array<uint8_t,crypto_aead_chacha20poly1305_KEYBYTES>& sessionKey,const uint64_t nonce,
+                                       const uint8_t* ad,const std::size_t adSize,const uint8_t* payload,const std::size_t payloadSize,
+                                       std::array<uint8_t,crypto_onetimeauth_poly1305_BYTES>& tag){
+    static_assert(crypto_onetimeauth_poly1305_BYTES==crypto_aead_chacha20poly1305_ABYTES,"Same packet layout as with encryption");
+    std::array<uint8_t,crypto_onetimeauth_poly1305_KEYBYTES> oneTimeKey{};
+    crypto_stream_chacha20(oneTimeKey.data(),oneTimeKey.size(),(const uint8_t*)&nonce,sessionKey.data());
+    crypto_onetimeauth_poly1305_state state;
+    crypto_onetimeauth_poly1305_init(&state,oneTimeKey.data());
+    crypto_onetimeauth_poly1305_update(&state,ad,adSize);
+    crypto_onetimeauth_poly1305_update(&state,payload,payloadSize);
+    crypto_onetimeauth_poly1305_final(&state,tag.data());
+}
+
+// What the tx boxes (encrypts and authenticates with the tx/rx keypair) into the session key packet.
+// The encryption mode and the cipher are part of it, such that nobody but the tx can change how the data packets are protected.
+struct SessionKeyPlaintext{
+    std::array<uint8_t,crypto_aead_chacha20poly1305_KEYBYTES> key;
+    uint8_t encryptionMode; // see EncryptionMode
+    uint8_t cipher; // see Cipher
+}__attribute__ ((packed));
+static_assert(sizeof(SessionKeyPlaintext)==crypto_aead_chacha20poly1305_KEYBYTES+1+1,"ALWAYS_TRUE");
+// the boxed SessionKeyPlaintext, as sent in the session key packet
+using SessionKeyData=std::array<uint8_t,sizeof(SessionKeyPlaintext)+crypto_box_MACBYTES>;
+
 class Encryptor {
 public:
     // enable a default deterministic encryption key by using std::nullopt
     // else, pass path to file with encryption keys
-    explicit Encryptor(std::optional<std::string> keypair,const bool DISABLE_ENCRYPTION_FOR_PERFORMANCE=false):DISABLE_ENCRYPTION_FOR_PERFORMANCE(DISABLE_ENCRYPTION_FOR_PERFORMANCE) {
+    // @param encryptionMode, cipher: announced to the rx together with the session key. The cipher has to be available (see selectCipher() )
+    explicit Encryptor(std::optional<std::string> keypair,const bool DISABLE_ENCRYPTION_FOR_PERFORMANCE=false,const EncryptionMode encryptionMode=EncryptionMode::ENCRYPT_AND_AUTHENTICATE,
+                       const Cipher cipher=Cipher::CHACHA20_POLY1305):
+        DISABLE_ENCRYPTION_FOR_PERFORMANCE(DISABLE_ENCRYPTION_FOR_PERFORMANCE),encryptionMode(encryptionMode),cipher(cipher) {
+        if(!isCipherAvailable((uint8_t)cipher)){
+            throw std::runtime_error(StringFormat::convert("Cipher %d is not available", (int)cipher));
+        }
         if(keypair==std::nullopt){
             // use default encryption keys
             crypto_box_seed_keypair(rx_publickey.data(),tx_secretkey.data(),DEFAULT_ENCRYPTION_SEED.data());
@@ -43,14 +125,21 @@ public:
             }
             fclose(fp);
         }
+        // the keypair never changes, so the shared key is calculated only once
+        if(crypto_box_beforenm(boxKey.data(),rx_publickey.data(),tx_secretkey.data())!=0){
+            throw std::runtime_error("Unable to calculate shared key!");
+        }
     }
     // Don't forget to send the session key after creating a new one !
-    void makeNewSessionKey(std::array<uint8_t,crypto_box_NONCEBYTES>& sessionKeyNonce,std::array<uint8_t,crypto_aead_chacha20poly1305_KEYBYTES + crypto_box_MACBYTES>& sessionKeyData){
-        randombytes_buf(session_key.data(), sizeof(session_key));
-        randombytes_buf(sessionKeyNonce.data(), sizeof(sessionKeyNonce));
-        if (crypto_box_easy(sessionKeyData.data(), session_key.data(), sizeof(session_key),
-                            sessionKeyNonce.data(), rx_publickey.data(), tx_secretkey.data()) != 0) {
-            throw std::runtime_error("Unable to make session key!");
+    // The next session key is prepared on a background thread, such that (except for the first call) this doesn't stall the caller
+    void makeNewSessionKey(std::array<uint8_t,crypto_box_NONCEBYTES>& sessionKeyNonce,SessionKeyData& sessionKeyData){
+        const SessionKey newSessionKey=nextSessionKey.valid() ? nextSessionKey.get() : createSessionKey();
+        session_key=newSessionKey.key;
+        sessionKeyNonce=newSessionKey.nonce;
+        sessionKeyData=newSessionKey.data;
+        nextSessionKey=std::async(std::launch::async,&Encryptor::createSessionKey,this);
+        if(cipher==Cipher::AES256GCM){
+            crypto_aead_aes256gcm_beforenm(&aesState,session_key.data());
         }
     }
     // Encrypt the payload using a public nonce. (aka sequence number)
@@ -59,28 +148,92 @@ public:
     // presumably right in front of the actual payload
     template<class T>
     std::vector<uint8_t> encryptPacket(const uint64_t nonce, const uint8_t* payload, std::size_t payloadSize, const T& ad){
+        std::vector<uint8_t> encryptedData=std::vector<uint8_t>(calculateEncryptedSize(payloadSize));
+        const auto encryptedSize=encryptPacket(nonce,payload,payloadSize,ad,encryptedData.data());
+        assert(encryptedData.size()==encryptedSize);
+        return encryptedData;
+    }
+    // Same as above, but writes the encrypted data into @param dest instead of allocating a new buffer.
+    // @param dest must have space for at least calculateEncryptedSize(payloadSize) bytes. Encrypting in place (dest==payload) is supported.
+    // @return the n of bytes written to dest
+    template<class T>
+    std::size_t encryptPacket(const uint64_t nonce, const uint8_t* payload, std::size_t payloadSize, const T& ad,uint8_t* dest){
         if(DISABLE_ENCRYPTION_FOR_PERFORMANCE){
-            return std::vector<uint8_t>(payload,payload+payloadSize);
+            memmove(dest,payload,payloadSize);
+            return payloadSize;
+        }
+        if(encryptionMode==EncryptionMode::AUTHENTICATE_ONLY){
+            memmove(dest,payload,payloadSize);
+            std::array<uint8_t,crypto_onetimeauth_poly1305_BYTES> tag;
+            calculateAuthenticationTag(session_key,nonce,(const uint8_t*)&ad,sizeof(ad),dest,payloadSize,tag);
+            memcpy(dest+payloadSize,tag.data(),tag.size());
+            return payloadSize+tag.size();
         }
-        std::vector<uint8_t> encryptedData=std::vector<uint8_t>(payloadSize+ crypto_aead_chacha20poly1305_ABYTES);
         long long unsigned int ciphertext_len;
-        crypto_aead_chacha20poly1305_encrypt(encryptedData.data(), &ciphertext_len,
-                                             payload, payloadSize,
-                                             (uint8_t *)&ad, sizeof(ad),
-                                             nullptr,
-                                             (uint8_t *) (&nonce), session_key.data());
-        // we allocate the right size in the beginning, but check if ciphertext_len is actually matching what we calculated
+        if(cipher==Cipher::AES256GCM){
+            const auto aesNonce=toAES256GCMNonce(nonce);
+            crypto_aead_aes256gcm_encrypt_afternm(dest, &ciphertext_len,
+                                                  payload, payloadSize,
+                                                  (uint8_t *)&ad, sizeof(ad),
+                                                  nullptr,
+                                                  aesNonce.data(), &aesState);
+        }else{
+            crypto_aead_chacha20poly1305_encrypt(dest, &ciphertext_len,
+                                                 payload, payloadSize,
+                                                 (uint8_t *)&ad, sizeof(ad),
+                                                 nullptr,
+                                                 (uint8_t *) (&nonce), session_key.data());
+        }
+        // check if ciphertext_len is actually matching what we calculated
         // (the documentation says 'write up to n bytes' but they probably mean (write exactly n bytes unless an error occurs)
-        assert(encryptedData.size()==ciphertext_len);
-        return encryptedData;
+        assert(calculateEncryptedSize(payloadSize)==ciphertext_len);
+        return ciphertext_len;
+    }
+    // n of bytes encryptPacket() creates from @param payloadSize bytes
+    std::size_t calculateEncryptedSize(const std::size_t payloadSize)const{
+        return DISABLE_ENCRYPTION_FOR_PERFORMANCE ? payloadSize : payloadSize+crypto_aead_chacha20poly1305_ABYTES;
+    }
+    EncryptionMode getEncryptionMode()const{
+        return encryptionMode;
+    }
+    Cipher getCipher()const{
+        return cipher;
     }
 private:
     // tx->rx keypair
     std::array<uint8_t, crypto_box_SECRETKEYBYTES> tx_secretkey{};
     std::array<uint8_t, crypto_box_PUBLICKEYBYTES> rx_publickey{};
     std::array<uint8_t, crypto_aead_chacha20poly1305_KEYBYTES> session_key{};
+    // expanded AES key, only re-calculated when the session key changes (only used with AES256GCM)
+    crypto_aead_aes256gcm_state aesState{};
+    // precomputed shared key for crypto_box (tx secret key, rx public key)
+    std::array<uint8_t, crypto_box_BEFORENMBYTES> boxKey{};
     // use this one if you are worried about CPU usage when using encryption
     const bool DISABLE_ENCRYPTION_FOR_PERFORMANCE;
+    const EncryptionMode encryptionMode;
+    const Cipher cipher;
+    struct SessionKey{
+        std::array<uint8_t, crypto_aead_chacha20poly1305_KEYBYTES> key;
+        std::array<uint8_t,crypto_box_NONCEBYTES> nonce;
+        SessionKeyData data;
+    };
+    // only reads const members, therefore safe to call from the background thread
+    SessionKey createSessionKey()const{
+        SessionKey ret{};
+        randombytes_buf(ret.key.data(), sizeof(ret.key));
+        randombytes_buf(ret.nonce.data(), sizeof(ret.nonce));
+        SessionKeyPlaintext plaintext{};
+        plaintext.key=ret.key;
+        plaintext.encryptionMode=(uint8_t)encryptionMode;
+        plaintext.cipher=(uint8_t)cipher;
+        if (crypto_box_easy_afternm(ret.data.data(), (const uint8_t*)&plaintext, sizeof(plaintext),
+                                    ret.nonce.data(), boxKey.data()) != 0) {
+            throw std::runtime_error("Unable to make session key!");
+        }
+        return ret;
+    }
+    // declared last, such that the destructor waits for the background thread before anything it uses is destroyed
+    std::future<SessionKey> nextSessionKey;
 };
 
 class Decryptor {
@@ -88,6 +241,7 @@ public:
     // enable a default deterministic encryption key by using std::nullopt
     // else, pass path to file with encryption keys
     explicit Decryptor(std::optional<std::string> keypair,const bool DISABLE_ENCRYPTION_FOR_PERFORMANCE=false):DISABLE_ENCRYPTION_FOR_PERFORMANCE(DISABLE_ENCRYPTION_FOR_PERFORMANCE) {
+        initializeSodium();
         if(keypair==std::nullopt){
             crypto_box_seed_keypair(tx_publickey.data(),rx_secretkey.data(),DEFAULT_ENCRYPTION_SEED.data());
             std::cout<<"Using default keys\n";
@@ -107,6 +261,10 @@ public:
             fclose(fp);
         }
         memset(session_key.data(), '\0', sizeof(session_key));
+        // the keypair never changes, so the shared key is calculated only once
+        if(crypto_box_beforenm(boxKey.data(),tx_publickey.data(),rx_secretkey.data())!=0){
+            throw std::runtime_error("Unable to calculate shared key!");
+        }
     }
 private:
     // use this one if you are worried about CPU usage when using encryption
@@ -118,48 +276,129 @@ public:
     std::array<uint8_t, crypto_aead_chacha20poly1305_KEYBYTES> session_key{};
 public:
     // return true if a new session was detected (The same session key can be sent multiple times by the tx)
-    bool onNewPacketSessionKeyData(std::array<uint8_t,crypto_box_NONCEBYTES>& sessionKeyNonce,std::array<uint8_t,crypto_aead_chacha20poly1305_KEYBYTES + crypto_box_MACBYTES>& sessionKeyData) {
-        std::array<uint8_t, sizeof(session_key)> new_session_key{};
-        if (crypto_box_open_easy(new_session_key.data(),
-                                 sessionKeyData.data(), sessionKeyData.size(),
-                                 sessionKeyNonce.data(),
-                                 tx_publickey.data(), rx_secretkey.data()) != 0) {
+    // A new session is a new session key, encryption mode or cipher - they are only accepted together, from an authentic session key packet.
+    bool onNewPacketSessionKeyData(std::array<uint8_t,crypto_box_NONCEBYTES>& sessionKeyNonce,SessionKeyData& sessionKeyData) {
+        // The tx sends the same session key packet over and over again (and each rx card receives it).
+        // If the bytes are exactly the same as the last authentic session key packet, there is nothing to do.
+        if(lastSessionKeyPacketValid && lastSessionKeyNonce==sessionKeyNonce && lastSessionKeyData==sessionKeyData){
+            count_session_key_packets_unchanged++;
+            return false;
+        }
+        SessionKeyPlaintext newSession{};
+        if (crypto_box_open_easy_afternm((uint8_t*)&newSession,
+                                         sessionKeyData.data(), sessionKeyData.size(),
+                                         sessionKeyNonce.data(), boxKey.data()) != 0) {
             // this basically should just never happen, and is an error
             std::cerr<<"unable to decrypt session key\n";
             return false;
         }
-        if (memcmp(session_key.data(), new_session_key.data(), sizeof(session_key)) != 0) {
+        if(!isValidEncryptionMode(newSession.encryptionMode)){
+            std::cerr<<"invalid encryption mode in session key packet "<<(int)newSession.encryptionMode<<"\n";
+            return false;
+        }
+        if(!isCipherAvailable(newSession.cipher)){
+            std::cerr<<"cipher "<<(int)newSession.cipher<<" selected by the tx is not available on this rx\n";
+            return false;
+        }
+        lastSessionKeyNonce=sessionKeyNonce;
+        lastSessionKeyData=sessionKeyData;
+        lastSessionKeyPacketValid=true;
+        if (session_key!=newSession.key || encryptionMode!=(EncryptionMode)newSession.encryptionMode || cipher!=(Cipher)newSession.cipher) {
             // this is NOT an error, the same session key is sent multiple times !
             std::cout<<"Decryptor-New session detected\n";
-            session_key = new_session_key;
+            session_key = newSession.key;
+            encryptionMode=(EncryptionMode)newSession.encryptionMode;
+            cipher=(Cipher)newSession.cipher;
+            aesStateValid=false;
             return true;
         }
         return false;
     }
+    // both selected by the tx, valid after the first session key packet has been accepted
+    EncryptionMode getEncryptionMode()const{
+        return encryptionMode;
+    }
+    Cipher getCipher()const{
+        return cipher;
+    }
 
     // returns decrypted data on success
     // NOTE: Don't forget to substract the "extradata" from raw received packet (to get payload)
     template<class T>
     std::optional<std::vector<uint8_t>> decryptPacket(const uint64_t nonce,const uint8_t* encryptedPayload,std::size_t encryptedPayloadSize,const T& ad) {
+        if(!DISABLE_ENCRYPTION_FOR_PERFORMANCE && encryptedPayloadSize<crypto_aead_chacha20poly1305_ABYTES){
+            return std::nullopt;
+        }
+        std::vector<uint8_t> decrypted(DISABLE_ENCRYPTION_FOR_PERFORMANCE ? encryptedPayloadSize : encryptedPayloadSize-crypto_aead_chacha20poly1305_ABYTES);
+        const auto decryptedSize=decryptPacket(nonce,encryptedPayload,encryptedPayloadSize,ad,decrypted.data());
+        if(decryptedSize==std::nullopt){
+            return std::nullopt;
+        }
+        assert(decrypted.size()==*decryptedSize);
+        return decrypted;
+    }
+    // Same as above, but writes the decrypted data into @param dest instead of allocating a new buffer.
+    // @param dest must have space for at least encryptedPayloadSize bytes. Decrypting in place (dest==encryptedPayload) is supported.
+    // @return the n of bytes written to dest on success
+    template<class T>
+    std::optional<std::size_t> decryptPacket(const uint64_t nonce,const uint8_t* encryptedPayload,std::size_t encryptedPayloadSize,const T& ad,uint8_t* dest) {
         if(DISABLE_ENCRYPTION_FOR_PERFORMANCE){
-            return std::vector<uint8_t>(encryptedPayload,encryptedPayload+encryptedPayloadSize);
+            memmove(dest,encryptedPayload,encryptedPayloadSize);
+            return encryptedPayloadSize;
+        }
+        if(encryptionMode==EncryptionMode::AUTHENTICATE_ONLY){
+            if(encryptedPayloadSize<crypto_onetimeauth_poly1305_BYTES){
+                return std::nullopt;
+            }
+            const std::size_t payloadSize=encryptedPayloadSize-crypto_onetimeauth_poly1305_BYTES;
+            std::array<uint8_t,crypto_onetimeauth_poly1305_BYTES> tag;
+            calculateAuthenticationTag(session_key,nonce,(const uint8_t*)&ad,sizeof(ad),encryptedPayload,payloadSize,tag);
+            if(crypto_verify_16(tag.data(),encryptedPayload+payloadSize)!=0){
+                return std::nullopt;
+            }
+            memmove(dest,encryptedPayload,payloadSize);
+            return payloadSize;
         }
-        std::vector<uint8_t> decrypted;
-        decrypted.resize(encryptedPayloadSize-crypto_aead_chacha20poly1305_ABYTES);
-
         long long unsigned int decrypted_len;
         const unsigned long long int cLen=encryptedPayloadSize;
 
-        if (crypto_aead_chacha20poly1305_decrypt(decrypted.data(), &decrypted_len,
+        if(cipher==Cipher::AES256GCM){
+            if(!aesStateValid){
+                crypto_aead_aes256gcm_beforenm(&aesState,session_key.data());
+                aesStateValid=true;
+            }
+            const auto aesNonce=toAES256GCMNonce(nonce);
+            if (crypto_aead_aes256gcm_decrypt_afternm(dest, &decrypted_len,
+                                                      nullptr,
+                                                      encryptedPayload, cLen,
+                                                      (uint8_t*)&ad, sizeof(ad),
+                                                      aesNonce.data(), &aesState) != 0) {
+                return std::nullopt;
+            }
+        }else if (crypto_aead_chacha20poly1305_decrypt(dest, &decrypted_len,
                                                  nullptr,
                                                  encryptedPayload, cLen,
                                                  (uint8_t*)&ad, sizeof(ad),
                                                  (uint8_t *) (&nonce), session_key.data()) != 0) {
             return std::nullopt;
         }
-        assert(decrypted.size()==decrypted_len);
-        return decrypted;
+        assert(encryptedPayloadSize-crypto_aead_chacha20poly1305_ABYTES==decrypted_len);
+        return decrypted_len;
     }
+    // n of session key packets that were skipped since they are the same as the last one
+    uint64_t count_session_key_packets_unchanged=0;
+private:
+    EncryptionMode encryptionMode=EncryptionMode::ENCRYPT_AND_AUTHENTICATE;
+    Cipher cipher=Cipher::CHACHA20_POLY1305;
+    // expanded AES key, only re-calculated when the session key changes (only used with AES256GCM)
+    crypto_aead_aes256gcm_state aesState{};
+    bool aesStateValid=false;
+    // precomputed shared key for crypto_box (tx public key, rx secret key)
+    std::array<uint8_t, crypto_box_BEFORENMBYTES> boxKey{};
+    // the last authentic session key packet
+    std::array<uint8_t,crypto_box_NONCEBYTES> lastSessionKeyNonce{};
+    SessionKeyData lastSessionKeyData{};
+    bool lastSessionKeyPacketValid=false;
 };
 
 #endif //ENCRYPTION_HPP
\ No newline at end of file
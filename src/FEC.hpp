@@ -47,46 +47,108 @@ void fecEncode(unsigned int fragmentSize, std::vector<std::array<uint8_t,S>>& bl
     //std::cout<<"fec_encode step took:"<<std::chrono::duration_cast<std::chrono::microseconds>(delta).count()<<"us\n";
 }
 
-enum FragmentStatus{UNAVAILABLE=0,AVAILABLE=1};
+// Marks which fragments (primary or secondary) of a block are available.
+// Fixed size bitmap instead of one int per fragment - no allocations, and finding the next gap or counting
+// the available fragments is done 64 fragments at a time (count trailing zeroes / popcount).
+class FragmentBitmap{
+public:
+    // enough for MAX_TOTAL_FRAGMENTS_PER_BLOCK
+    static constexpr unsigned int N_BITS=256;
+    void set(const unsigned int idx){
+        assert(idx<N_BITS);
+        words[idx/64] |= (uint64_t(1) << (idx%64));
+    }
+    void reset(const unsigned int idx){
+        assert(idx<N_BITS);
+        words[idx/64] &= ~(uint64_t(1) << (idx%64));
+    }
+    bool test(const unsigned int idx)const{
+        assert(idx<N_BITS);
+        return (words[idx/64] >> (idx%64)) & 1;
+    }
+    // returns the n of set bits in [begin,end[
+    unsigned int count(const unsigned int begin,const unsigned int end)const{
+        assert(begin<=end && end<=N_BITS);
+        unsigned int ret=0;
+        for(unsigned int w=begin/64; w*64<end; w++){
+            ret+=__builtin_popcountll(words[w] & rangeMask(w,begin,end));
+        }
+        return ret;
+    }
+    // returns the index of the first set bit in [begin,end[, or end if there is none
+    unsigned int findFirstSet(const unsigned int begin,const unsigned int end)const{
+        return findFirst(begin,end,false);
+    }
+    // returns the index of the first unset bit in [begin,end[, or end if there is none
+    unsigned int findFirstUnset(const unsigned int begin,const unsigned int end)const{
+        return findFirst(begin,end,true);
+    }
+private:
+    std::array<uint64_t,N_BITS/64> words{};
+    // mask for the bits of word w that lie inside [begin,end[
+    static uint64_t rangeMask(const unsigned int w,const unsigned int begin,const unsigned int end){
+        uint64_t mask=~uint64_t(0);
+        if(begin>w*64){
+            mask &= ~uint64_t(0) << (begin-w*64);
+        }
+        if(end<(w+1)*64){
+            mask &= (uint64_t(1) << (end-w*64))-1;
+        }
+        return mask;
+    }
+    unsigned int findFirst(const unsigned int begin,const unsigned int end,const bool unset)const{
+        assert(begin<=end && end<=N_BITS);
+        for(unsigned int w=begin/64; w*64<end; w++){
+            const uint64_t bits=(unset ? ~words[w] : words[w]) & rangeMask(w,begin,end);
+            if(bits!=0){
+                return w*64+__builtin_ctzll(bits);
+            }
+        }
+        return end;
+    }
+};
 
 /**
  * @param fragmentSize size of each fragment
  * @param blockBuffer blockBuffer (big) data buffer. The nth element is to be treated as the nth fragment of the block, either as primary or secondary fragment.
  * @param nPrimaryFragments n of primary fragments used during encode step
- * @param fragmentStatusList information which (primary or secondary fragments) were received.
- * values from [0,nPrimaryFragments[ are treated as primary fragments, values from [nPrimaryFragments,size[ are treated as secondary fragments.
- * @return indices of reconstructed primary fragments
+ * @param fragmentMap information which (primary or secondary fragments) were received.
+ * values from [0,nPrimaryFragments[ are treated as primary fragments, values from [nPrimaryFragments,blockBuffer.size()[ are treated as secondary fragments.
+ * After this call, all primary fragments are available (but @param fragmentMap is not modified)
+ * @return the n of reconstructed primary fragments
  */
 template<std::size_t S>
-std::vector<unsigned int> fecDecode(unsigned int fragmentSize, std::vector<std::array<uint8_t,S>>& blockBuffer, const unsigned int nPrimaryFragments, const std::vector<FragmentStatus>& fragmentStatusList){
+unsigned int fecDecode(unsigned int fragmentSize, std::vector<std::array<uint8_t,S>>& blockBuffer, const unsigned int nPrimaryFragments, const FragmentBitmap& fragmentMap){
     assert(fragmentSize <= S);
-    assert(fragmentStatusList.size() <= blockBuffer.size());
-    assert(fragmentStatusList.size()==blockBuffer.size());
-    std::vector<unsigned int> indicesMissingPrimaryFragments;
-    std::vector<uint8_t*> primaryFragmentP(nPrimaryFragments);
+    assert(blockBuffer.size() <= FragmentBitmap::N_BITS);
+    assert(nPrimaryFragments<=blockBuffer.size());
+    const unsigned int nFragments=blockBuffer.size();
+    // no allocations, the index / pointer lists live on the stack
+    std::array<unsigned int,FragmentBitmap::N_BITS> indicesMissingPrimaryFragments;
+    std::array<uint8_t*,FragmentBitmap::N_BITS> primaryFragmentP;
+    std::array<unsigned int,FragmentBitmap::N_BITS> secondaryFragmentIndices;
+    std::array<uint8_t*,FragmentBitmap::N_BITS> secondaryFragmentP;
+    unsigned int nMissingPrimaryFragments=0;
+    for(unsigned int idx=fragmentMap.findFirstUnset(0,nPrimaryFragments); idx<nPrimaryFragments; idx=fragmentMap.findFirstUnset(idx+1,nPrimaryFragments)){
+        indicesMissingPrimaryFragments[nMissingPrimaryFragments++]=idx;
+    }
     for(unsigned int idx=0;idx<nPrimaryFragments;idx++){
-        if(fragmentStatusList[idx] == UNAVAILABLE){
-            indicesMissingPrimaryFragments.push_back(idx);
-        }
         primaryFragmentP[idx]=blockBuffer[idx].data();
     }
-    // find enough secondary fragments
-    std::vector<uint8_t*> secondaryFragmentP;
-    std::vector<unsigned int> secondaryFragmentIndices;
-    for(int i=0; i < fragmentStatusList.size() - nPrimaryFragments; i++) {
-        const auto idx = nPrimaryFragments + i;
-        if(fragmentStatusList[idx] == AVAILABLE){
-            secondaryFragmentP.push_back(blockBuffer[idx].data());
-            secondaryFragmentIndices.push_back(i);
-        }
-    }
     // make sure we got enough secondary fragments
-    assert(secondaryFragmentP.size()>=indicesMissingPrimaryFragments.size());
-    // assert if fecDecode is called too late (e.g. more secondary fragments than needed for fec
-    assert(indicesMissingPrimaryFragments.size()==secondaryFragmentP.size());
+    // and assert if fecDecode is called too late (e.g. more secondary fragments than needed for fec)
+    assert(fragmentMap.count(nPrimaryFragments,nFragments)==nMissingPrimaryFragments);
+    unsigned int nSecondaryFragments=0;
+    for(unsigned int idx=fragmentMap.findFirstSet(nPrimaryFragments,nFragments); idx<nFragments; idx=fragmentMap.findFirstSet(idx+1,nFragments)){
+        secondaryFragmentP[nSecondaryFragments]=blockBuffer[idx].data();
+        // secondary fragment numbers start from 0, not from nPrimaryFragments
+        secondaryFragmentIndices[nSecondaryFragments]=idx-nPrimaryFragments;
+        nSecondaryFragments++;
+    }
     // do fec step
-    fec_decode2(fragmentSize,primaryFragmentP,indicesMissingPrimaryFragments,secondaryFragmentP,secondaryFragmentIndices);
-    return indicesMissingPrimaryFragments;
+    fec_decode(fragmentSize,primaryFragmentP.data(),nPrimaryFragments,secondaryFragmentP.data(),
+               secondaryFragmentIndices.data(),indicesMissingPrimaryFragments.data(),nMissingPrimaryFragments);
+    return nMissingPrimaryFragments;
 }
 
 // randomly select a possible combination of received indices (either primary or secondary).
@@ -111,10 +173,10 @@ static void testFecCPlusPlusWrapperY(const int nPrimaryFragments,const int nSeco
         std::cout<<"(Emulated) receivedFragmentIndices"<<StringHelper::vectorAsString(receivedFragmentIndices)<<"\n";
 
         auto rxBlockBuffer=std::vector<std::array<uint8_t,FRAGMENT_SIZE>>(nPrimaryFragments+nSecondaryFragments);
-        std::vector<FragmentStatus> fragmentMap(nPrimaryFragments+nSecondaryFragments,FragmentStatus::UNAVAILABLE);
+        FragmentBitmap fragmentMap;
         for(const auto idx:receivedFragmentIndices){
             rxBlockBuffer[idx]=txBlockBuffer[idx];
-            fragmentMap[idx]=FragmentStatus::AVAILABLE;
+            fragmentMap.set(idx);
         }
 
         fecDecode(FRAGMENT_SIZE, rxBlockBuffer, nPrimaryFragments, fragmentMap);
@@ -15,7 +15,11 @@
 #include <stdexcept>
 #include <iostream>
 #include <functional>
-#include <map>
+#include <algorithm>
+#include <cassert>
+#include <limits>
+#include <chrono>
+#include <optional>
 
 // FEC Disabled is an optional user input (K==0). In this case, These 2 classes are used.
 
@@ -38,39 +42,199 @@ private:
 
 class FECDisabledDecoder{
 public:
+    // @param windowSize: n of most recent sequence numbers that are checked for duplicates (rounded up to a multiple of 64)
+    // @param maxReorderDelay: if not 0, packets are forwarded in order, but a packet is held back for at most this long
+    // waiting on the packets in front of it. Otherwise, packets are forwarded in the order they are received.
+    explicit FECDisabledDecoder(const std::size_t windowSize=DEFAULT_WINDOW_SIZE,const std::chrono::steady_clock::duration maxReorderDelay=std::chrono::steady_clock::duration(0)):
+        receivedSeqNrWindow((std::max(windowSize,(std::size_t)1)+63)/64,0),windowSize(receivedSeqNrWindow.size()*64),maxReorderDelay(maxReorderDelay){}
     typedef std::function<void(const uint8_t * payload,std::size_t payloadSize)> SEND_DECODED_PACKET;
     // WARNING: Don't forget to register this callback !
     SEND_DECODED_PACKET mSendDecodedPayloadCallback;
+    static constexpr std::size_t DEFAULT_WINDOW_SIZE=1024;
+    // packets that are further ahead than this are not buffered, but force the release of the oldest packets / gaps
+    static constexpr std::size_t MAX_REORDER_BUFFER_SIZE=64;
 private:
-    // Add a limit here to not allocate infinite amounts of memory
-    static constexpr std::size_t FEC_DISABLED_MAX_SIZE_OF_MAP=100;
-    std::map<uint64_t,void*> fecDisabledMapOfReceivedSeqNr;
+    // Sliding window (like the IPsec anti-replay window): Bit (seqNr % windowSize) is set if the packet with this sequence number
+    // has been received, for all sequence numbers in ]highestSeqNr-windowSize,highestSeqNr]. Fixed size, allocated once.
+    std::vector<uint64_t> receivedSeqNrWindow;
+    const std::size_t windowSize;
+    uint64_t highestSeqNr=0;
     bool firstEverPacket=true;
+    bool isMarked(const uint64_t seqNr)const{
+        const auto bitIdx=seqNr % windowSize;
+        return (receivedSeqNrWindow[bitIdx/64] >> (bitIdx%64)) & 1;
+    }
+    void setMarked(const uint64_t seqNr,const bool marked){
+        const auto bitIdx=seqNr % windowSize;
+        if(marked){
+            receivedSeqNrWindow[bitIdx/64] |= (uint64_t(1) << (bitIdx%64));
+        }else{
+            receivedSeqNrWindow[bitIdx/64] &= ~(uint64_t(1) << (bitIdx%64));
+        }
+    }
+    // move the window such that @param seqNr is the newest sequence number inside it
+    void advanceWindow(const uint64_t seqNr){
+        assert(seqNr>highestSeqNr);
+        if(seqNr-highestSeqNr>=windowSize){
+            std::fill(receivedSeqNrWindow.begin(),receivedSeqNrWindow.end(),0);
+        }else{
+            // the sequence numbers between the old and new highest one have not been received yet
+            for(uint64_t i=highestSeqNr+1;i<=seqNr;i++){
+                setMarked(i, false);
+            }
+        }
+        highestSeqNr=seqNr;
+    }
+    // Re-order buffer, only used if maxReorderDelay is not 0. Indexed by seqNr % MAX_REORDER_BUFFER_SIZE,
+    // the data vectors keep their capacity such that there are no allocations after a while.
+    const std::chrono::steady_clock::duration maxReorderDelay;
+    struct BufferedPacket{
+        bool valid=false;
+        uint64_t seqNr=0;
+        std::chrono::steady_clock::time_point receivedTime;
+        std::vector<uint8_t> data;
+    };
+    std::array<BufferedPacket,MAX_REORDER_BUFFER_SIZE> reorderBuffer;
+    std::size_t nBufferedPackets=0;
+    // the sequence number of the packet that is forwarded next (everything before has been forwarded or given up)
+    uint64_t nextSeqNr=0;
+    bool isReorderingEnabled()const{
+        return maxReorderDelay>std::chrono::steady_clock::duration(0);
+    }
+    BufferedPacket& getBufferSlot(const uint64_t seqNr){
+        return reorderBuffer[seqNr % MAX_REORDER_BUFFER_SIZE];
+    }
+    void forwardBufferedPacket(BufferedPacket& slot){
+        assert(slot.valid);
+        mSendDecodedPayloadCallback(slot.data.data(), slot.data.size());
+        slot.valid=false;
+        nBufferedPackets--;
+    }
+    // forward all buffered packets without a gap in front of them
+    void releaseConsecutive(){
+        while(nBufferedPackets>0){
+            auto& slot=getBufferSlot(nextSeqNr);
+            if(!slot.valid || slot.seqNr!=nextSeqNr)return;
+            forwardBufferedPacket(slot);
+            nextSeqNr++;
+        }
+    }
+    // give up on all gaps before @param seqNr, forwarding the buffered packets in front of it in order
+    void skipTo(const uint64_t seqNr){
+        while(nBufferedPackets>0 && nextSeqNr<seqNr){
+            auto& slot=getBufferSlot(nextSeqNr);
+            if(slot.valid && slot.seqNr==nextSeqNr){
+                forwardBufferedPacket(slot);
+            }
+            nextSeqNr++;
+        }
+        nextSeqNr=std::max(nextSeqNr,seqNr);
+    }
+    void forwardInOrder(const uint64_t packetSeq,const std::vector<uint8_t>& decrypted){
+        if(packetSeq<nextSeqNr){
+            // we already gave up waiting on this one, forward it anyways
+            count_reorder_late++;
+            mSendDecodedPayloadCallback(decrypted.data(), decrypted.size());
+            return;
+        }
+        if(packetSeq-nextSeqNr>=MAX_REORDER_BUFFER_SIZE){
+            // make room in the buffer
+            skipTo(packetSeq-MAX_REORDER_BUFFER_SIZE+1);
+            releaseConsecutive();
+        }
+        if(packetSeq==nextSeqNr){
+            mSendDecodedPayloadCallback(decrypted.data(), decrypted.size());
+            nextSeqNr++;
+            releaseConsecutive();
+            return;
+        }
+        auto& slot=getBufferSlot(packetSeq);
+        assert(!slot.valid);
+        slot.valid=true;
+        slot.seqNr=packetSeq;
+        slot.receivedTime=std::chrono::steady_clock::now();
+        slot.data.assign(decrypted.begin(),decrypted.end());
+        nBufferedPackets++;
+    }
 public:
     //No duplicates, but packets out of order are possible
     //counting lost packets doesn't work in this mode. It should be done by the upper level
-    //saves the last FEC_DISABLED_MAX_SIZE_OF_MAP sequence numbers. If the sequence number of a new packet is already inside the map, it is discarded (duplicate)
-    void processRawDataBlockFecDisabled(const uint64_t packetSeq,const std::vector<uint8_t>& decrypted){
+    //A packet is discarded if its sequence number has already been received (duplicate) or if it is too old to tell (out of window)
+    // @param rxCardIdx the rx card this packet was received on, only used for the duplicate statistics
+    void processRawDataBlockFecDisabled(const uint64_t packetSeq,const std::vector<uint8_t>& decrypted,const int rxCardIdx=0){
         if(firstEverPacket){
-            // first ever packet. Map should be empty
-            fecDisabledMapOfReceivedSeqNr.clear();
-            mSendDecodedPayloadCallback(decrypted.data(), decrypted.size());
-            fecDisabledMapOfReceivedSeqNr.insert({packetSeq, nullptr});
+            highestSeqNr=packetSeq;
+            nextSeqNr=packetSeq+1;
+            setMarked(packetSeq,true);
             firstEverPacket= false;
+            mSendDecodedPayloadCallback(decrypted.data(), decrypted.size());
+            return;
         }
-        // check if packet is already known (inside the map)
-        const auto search = fecDisabledMapOfReceivedSeqNr.find(packetSeq);
-        if(search == fecDisabledMapOfReceivedSeqNr.end()){
-            // if packet is not in the map it was not yet received(unless it is older than MAX_SIZE_OF_MAP, but that is basically impossible)
+        if(packetSeq>highestSeqNr){
+            // new packet, this is the common case
+            advanceWindow(packetSeq);
+        }else if(highestSeqNr-packetSeq>=windowSize){
+            // we cannot tell if this packet has been received already
+            count_out_of_window++;
+            return;
+        }else if(isMarked(packetSeq)){
+            // this is a duplicate
+            assert(rxCardIdx>=0);
+            if(rxCardIdx>=count_duplicates_per_rx_card.size()){
+                count_duplicates_per_rx_card.resize(rxCardIdx+1,0);
+            }
+            count_duplicates_per_rx_card[rxCardIdx]++;
+            return;
+        }
+        setMarked(packetSeq,true);
+        max_reorder_depth=std::max(max_reorder_depth,highestSeqNr-packetSeq);
+        if(isReorderingEnabled()){
+            forwardInOrder(packetSeq,decrypted);
+            releaseExpiredPackets();
+        }else{
             mSendDecodedPayloadCallback(decrypted.data(), decrypted.size());
-            fecDisabledMapOfReceivedSeqNr.insert({packetSeq, nullptr});
-        }// else this is a duplicate
-        // house keeping, do not increase size to infinity
-        if(fecDisabledMapOfReceivedSeqNr.size() >= FEC_DISABLED_MAX_SIZE_OF_MAP - 1){
-            // remove oldest element
-            fecDisabledMapOfReceivedSeqNr.erase(fecDisabledMapOfReceivedSeqNr.begin());
         }
     }
+    // Call this before decrypting a packet to drop copies of packets that have already been received (e.g. on another rx card)
+    // without any crypto. Since a sequence number is only marked as received once its packet has been authenticated,
+    // a packet dropped here would have been dropped after the decryption anyways.
+    // @return true if the packet has been dropped
+    bool dropAuthenticatedDuplicate(const uint64_t packetSeq,const int rxCardIdx=0){
+        if(firstEverPacket || packetSeq>highestSeqNr || highestSeqNr-packetSeq>=windowSize || !isMarked(packetSeq)){
+            return false;
+        }
+        assert(rxCardIdx>=0);
+        if(rxCardIdx>=count_duplicates_per_rx_card.size()){
+            count_duplicates_per_rx_card.resize(rxCardIdx+1,0);
+        }
+        count_duplicates_per_rx_card[rxCardIdx]++;
+        return true;
+    }
+    // Forward all buffered packets that have been waiting for longer than maxReorderDelay, and all packets in front of them.
+    // Call this regularly, since packets can only be released in processRawDataBlockFecDisabled() if new packets arrive.
+    void releaseExpiredPackets(){
+        if(nBufferedPackets==0)return;
+        const auto now=std::chrono::steady_clock::now();
+        std::optional<uint64_t> newestExpiredSeqNr=std::nullopt;
+        for(const auto& slot:reorderBuffer){
+            if(slot.valid && now-slot.receivedTime>=maxReorderDelay){
+                if(newestExpiredSeqNr==std::nullopt || slot.seqNr>*newestExpiredSeqNr){
+                    newestExpiredSeqNr=slot.seqNr;
+                }
+            }
+        }
+        if(newestExpiredSeqNr==std::nullopt)return;
+        skipTo(*newestExpiredSeqNr);
+        releaseConsecutive();
+    }
+    // n of duplicates, for each rx card
+    std::vector<uint64_t> count_duplicates_per_rx_card;
+    // n of packets that were too old to check if they are a duplicate (and therefore discarded)
+    uint64_t count_out_of_window=0;
+    // the biggest difference between the newest received sequence number and the sequence number of a (not duplicate) packet
+    uint64_t max_reorder_depth=0;
+    // n of packets that arrived after the re-order buffer already gave up waiting on them (forwarded out of order)
+    uint64_t count_reorder_late=0;
 };
 
 #endif //WIFIBROADCAST_FECDISABLED_HPP
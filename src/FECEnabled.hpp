@@ -18,6 +18,9 @@
 #include <iostream>
 #include <functional>
 #include <map>
+#include <optional>
+#include <deque>
+#include <algorithm>
 
 
 // RN this module depends on "wifibroadcast.hpp", since it holds the "packet size(s)" needed to calculate FEC_MAX_PAYLOAD_SIZE
@@ -86,6 +89,11 @@ static_assert(FEC_MAX_PAYLOAD_SIZE == 1446);
 static constexpr const uint16_t MAX_N_P_FRAGMENTS_PER_BLOCK=128;
 static constexpr const uint16_t MAX_N_S_FRAGMENTS_PER_BLOCK=128;
 static constexpr const uint16_t MAX_TOTAL_FRAGMENTS_PER_BLOCK=MAX_N_P_FRAGMENTS_PER_BLOCK+MAX_N_S_FRAGMENTS_PER_BLOCK;
+static_assert(MAX_TOTAL_FRAGMENTS_PER_BLOCK<=FragmentBitmap::N_BITS);
+// secondary fragments can be stored encrypted (see RxBlock::addEncryptedSecondaryFragment() ) - leave room for the MAC.
+// set here to remove dependency on libsodium
+static constexpr const auto MAX_ENCRYPTION_OVERHEAD=16;
+static constexpr const auto RX_BLOCK_FRAGMENT_BUFFER_SIZE=FEC_MAX_PACKET_SIZE+MAX_ENCRYPTION_OVERHEAD;
 
 // Takes a continuous stream of packets and
 // encodes them via FEC such that they can be decoded by FECDecoder
@@ -229,9 +237,8 @@ public:
     // allocate much more memory every time for a new RX block than needed.
     explicit RxBlock(const unsigned int maxNFragmentsPerBlock,const uint64_t blockIdx1):
             blockIdx(blockIdx1),
-            fragment_map(maxNFragmentsPerBlock, FragmentStatus::UNAVAILABLE), //after creation of the RxBlock every f. is marked as unavailable
             blockBuffer(maxNFragmentsPerBlock){
-        assert(fragment_map.size()==blockBuffer.size());
+        assert(maxNFragmentsPerBlock<=FragmentBitmap::N_BITS);
     }
     // No copy constructor for safety
     RxBlock(const RxBlock&)=delete;
@@ -248,7 +255,16 @@ public:
     // returns true if this fragment has been already received
     bool hasFragment(const FECNonce& fecNonce){
         assert(fecNonce.blockIdx==blockIdx);
-        return fragment_map[fecNonce.fragmentIdx]==AVAILABLE;
+        return fragment_map.test(fecNonce.fragmentIdx);
+    }
+    // same as hasFragment(), but a fragment that is still encrypted (not authenticated yet) doesn't count
+    bool hasAuthenticatedFragment(const FECNonce& fecNonce){
+        return hasFragment(fecNonce) && !encryptedFragments.test(fecNonce.fragmentIdx);
+    }
+    // returns true if this fragment has been received, but is still encrypted
+    bool hasEncryptedFragment(const FECNonce& fecNonce){
+        assert(fecNonce.blockIdx==blockIdx);
+        return encryptedFragments.test(fecNonce.fragmentIdx);
     }
     // returns true if we are "done with this block" aka all data has been already forwarded
     bool allPrimaryFragmentsHaveBeenForwarded()const{
@@ -267,25 +283,36 @@ public:
         if(nAvailablePrimaryFragments+nAvailableSecondaryFragments>=fec_k)return true;
         return false;
     }
+    // returns true if this block can never be recovered, assuming only fragments with an index >= @param firstPossibleFragmentIdx can still arrive
+    // (always false as long as k is not known)
+    bool isUnrecoverable(const unsigned int firstPossibleFragmentIdx)const{
+        if(fec_k==-1)return false;
+        const unsigned int begin=std::min(firstPossibleFragmentIdx,(unsigned int)blockBuffer.size());
+        const int nStillPossible=(int)(blockBuffer.size()-begin-fragment_map.count(begin,blockBuffer.size()));
+        return nAvailablePrimaryFragments+nAvailableSecondaryFragments+nStillPossible<fec_k;
+    }
     // returns true if suddenly all primary fragments have become available
     bool allPrimaryFragmentsAreAvailable()const{
         if(fec_k==-1)return false;
         return nAvailablePrimaryFragments==fec_k;
     }
+    // returns true if k is known for this block (from a fragment that has been added via addFragment() ) and equal to @param k
+    bool isKnownK(const int k)const{
+        return fec_k!=-1 && fec_k==k;
+    }
     // copy the fragment data and mark it as available
     // you should check if it is already available with hasFragment() to avoid storing a fragment multiple times
     // when using multiple RX cards
     void addFragment(const FECNonce& fecNonce, const uint8_t* data,const std::size_t dataLen){
         assert(!hasFragment(fecNonce));
         assert(fecNonce.blockIdx==blockIdx);
-        assert(fragment_map[fecNonce.fragmentIdx]==UNAVAILABLE);
         assert(fecNonce.fragmentIdx<blockBuffer.size());
         // write the data (doesn't matter if FEC data or correction packet)
         memcpy(blockBuffer[fecNonce.fragmentIdx].data(), data, dataLen);
         // set the rest to zero such that FEC works
         memset(blockBuffer[fecNonce.fragmentIdx].data() + dataLen, '\0', FEC_MAX_PACKET_SIZE - dataLen);
         // mark it as available
-        fragment_map[fecNonce.fragmentIdx] = FragmentStatus::AVAILABLE;
+        fragment_map.set(fecNonce.fragmentIdx);
         if(fecNonce.flag==0){
             nAvailablePrimaryFragments++;
             // when we receive the last primary fragment for this block we know the "K" parameter
@@ -315,6 +342,72 @@ public:
         }
         //std::cout<<"block_idx:"<<blockIdx<<" frag_idx:"<<(int)fecNonce.fragmentIdx<<" k:"<<fec_k<<" nP:"<<nAvailablePrimaryFragments<<"nS:"<<nAvailableSecondaryFragments<<"\n";
     }
+    // Authenticate and decrypt (in place) the data of a fragment. @return the decrypted size, or std::nullopt if the fragment is not authentic
+    typedef std::function<std::optional<std::size_t>(const uint64_t nonce,uint8_t* data,const std::size_t dataLen)> DECRYPT_IN_PLACE;
+    // Same as addFragment(), but the secondary fragment is stored as received (authenticated and encrypted). It counts as available,
+    // but has to be decrypted via decryptSecondaryFragments() before the FEC step. Most secondary fragments are never used
+    // for reconstruction, which means they are never decrypted.
+    // Only call this once k is known for this block (see isKnownK()), such that unauthenticated data can't change k.
+    void addEncryptedSecondaryFragment(const FECNonce& fecNonce, const uint8_t* data,const std::size_t dataLen){
+        assert(!hasFragment(fecNonce));
+        assert(fecNonce.blockIdx==blockIdx);
+        assert(fecNonce.fragmentIdx<blockBuffer.size());
+        assert(fecNonce.flag==1 && isKnownK(fecNonce.number));
+        assert(dataLen<=RX_BLOCK_FRAGMENT_BUFFER_SIZE);
+        memcpy(blockBuffer[fecNonce.fragmentIdx].data(), data, dataLen);
+        encryptedFragmentSize[fecNonce.fragmentIdx]=dataLen;
+        fragment_map.set(fecNonce.fragmentIdx);
+        encryptedFragments.set(fecNonce.fragmentIdx);
+        nAvailableSecondaryFragments++;
+        nEncryptedSecondaryFragments++;
+        if(firstFragmentTimePoint==std::nullopt){
+            firstFragmentTimePoint=std::chrono::steady_clock::now();
+        }
+    }
+    // @return true if the still encrypted fragment @param idx is byte-identical to @param data
+    bool isSameEncryptedFragment(const unsigned int idx,const uint8_t* data,const std::size_t dataLen)const{
+        assert(encryptedFragments.test(idx));
+        return encryptedFragmentSize[idx]==dataLen && memcmp(blockBuffer[idx].data(), data, dataLen)==0;
+    }
+    // Decrypt a secondary fragment that was added via addEncryptedSecondaryFragment().
+    // The nonce (WBDataHeader) of the fragment is re-created from the block idx, fragment idx and k.
+    // If the fragment is not authentic, it is removed (marked as not received) again.
+    // @return true if the fragment is authentic
+    bool decryptSecondaryFragment(const unsigned int idx,const DECRYPT_IN_PLACE& decryptInPlace){
+        assert(encryptedFragments.test(idx));
+        encryptedFragments.reset(idx);
+        nEncryptedSecondaryFragments--;
+        const FECNonce fecNonce{(uint32_t)blockIdx,(uint16_t)idx,1,(uint16_t)fec_k};
+        const auto decryptedSize=decryptInPlace((uint64_t)fecNonce, blockBuffer[idx].data(), encryptedFragmentSize[idx]);
+        // all secondary fragments shall have the same size
+        if(decryptedSize==std::nullopt || *decryptedSize>FEC_MAX_PACKET_SIZE ||
+           (sizeOfSecondaryFragments!=-1 && sizeOfSecondaryFragments!=*decryptedSize)){
+            fragment_map.reset(idx);
+            nAvailableSecondaryFragments--;
+            return false;
+        }
+        sizeOfSecondaryFragments=(int)*decryptedSize;
+        // set the rest to zero such that FEC works
+        memset(blockBuffer[idx].data() + *decryptedSize, '\0', FEC_MAX_PACKET_SIZE - *decryptedSize);
+        return true;
+    }
+    // Same as above, for all secondary fragments that are still encrypted
+    // @return the n of removed fragments
+    int decryptSecondaryFragments(const DECRYPT_IN_PLACE& decryptInPlace){
+        int nFailed=0;
+        const unsigned int end=blockBuffer.size();
+        for(unsigned int idx=encryptedFragments.findFirstSet(0,end); idx<end; idx=encryptedFragments.findFirstSet(idx+1,end)){
+            if(!decryptSecondaryFragment(idx,decryptInPlace)){
+                nFailed++;
+            }
+        }
+        assert(nEncryptedSecondaryFragments==0);
+        return nFailed;
+    }
+    // n of secondary fragments that are still encrypted
+    int getNEncryptedSecondaryFragments()const{
+        return nEncryptedSecondaryFragments;
+    }
     /**
      * @returns the indices for all primary fragments that have not yet been forwarded and are available (already received or reconstructed).
      * Once an index is returned here, it won't be returned again
@@ -324,26 +417,50 @@ public:
     std::vector<uint16_t> pullAvailablePrimaryFragments(const bool discardMissingPackets= false){
         // note: when pulling the available fragments, we do not need to know how many primary fragments this block actually contains
         std::vector<uint16_t> ret;
-        for(int i=nAlreadyForwardedPrimaryFragments; i < nAvailablePrimaryFragments; i++){
-            if(fragment_map[i]==FragmentStatus::UNAVAILABLE){
-                if(discardMissingPackets){
-                    continue;
-                }else{
-                    break;
-                }
+        // when discarding missing packets, available primary fragments can come after the n of available primary fragments.
+        // If k is not known yet, no secondary fragment has been received yet, so all available fragments are primary fragments
+        const unsigned int lastIdx=discardMissingPackets ? (fec_k!=-1 ? fec_k : (int)blockBuffer.size()) : nAvailablePrimaryFragments;
+        if(discardMissingPackets){
+            for(unsigned int i=fragment_map.findFirstSet(nAlreadyForwardedPrimaryFragments,lastIdx); i < lastIdx; i=fragment_map.findFirstSet(i+1,lastIdx)){
+                ret.push_back(i);
+            }
+        }else{
+            // everything up to the first gap
+            const unsigned int firstGap=fragment_map.findFirstUnset(nAlreadyForwardedPrimaryFragments,lastIdx);
+            for(unsigned int i=nAlreadyForwardedPrimaryFragments; i < firstGap; i++){
+                ret.push_back(i);
             }
-            ret.push_back(i);
         }
         // make sure these indices won't be returned again
         nAlreadyForwardedPrimaryFragments+=(int)ret.size();
         return ret;
     }
+    /**
+     * Same as above, but for the unordered output mode: Gaps are never waited on, but in contrast to discardMissingPackets=true
+     * the missing fragments are not lost - they are returned by a later call once they have been received or reconstructed.
+     * @returns the indices for all available primary fragments that have not been returned yet. Each index is returned exactly once.
+     */
+    std::vector<uint16_t> pullAvailablePrimaryFragmentsUnordered(){
+        std::vector<uint16_t> ret;
+        // If k is not known yet, no secondary fragment has been received yet, so all available fragments are primary fragments
+        const unsigned int lastIdx=fec_k!=-1 ? fec_k : (int)blockBuffer.size();
+        for(unsigned int i=fragment_map.findFirstSet(0,lastIdx); i < lastIdx; i=fragment_map.findFirstSet(i+1,lastIdx)){
+            if(!primaryFragmentForwarded.test(i)){
+                primaryFragmentForwarded.set(i);
+                ret.push_back(i);
+            }
+        }
+        // in this mode, this is the n of forwarded primary fragments (not the index we stopped at)
+        nAlreadyForwardedPrimaryFragments+=(int)ret.size();
+        return ret;
+    }
     const uint8_t* getDataPrimaryFragment(const uint16_t primaryFragmentIdx){
-        assert(fragment_map[primaryFragmentIdx] == AVAILABLE);
+        assert(fragment_map.test(primaryFragmentIdx));
         return blockBuffer[primaryFragmentIdx].data();
     }
     // returns the n of primary and secondary fragments for this block
     int getNAvailableFragments()const{
+        assert(fragment_map.count(0,blockBuffer.size())==nAvailablePrimaryFragments+nAvailableSecondaryFragments);
         return nAvailablePrimaryFragments+nAvailableSecondaryFragments;
     }
     // make sure to check if enough secondary fragments are available before calling this method !
@@ -359,16 +476,19 @@ public:
         assert(nAvailablePrimaryFragments<fec_k);
         assert(nAvailableSecondaryFragments>0);
         assert(sizeOfSecondaryFragments!=-1);
+        assert(nEncryptedSecondaryFragments==0);
         const int nMissingPrimaryFragments=fec_k-nAvailablePrimaryFragments;
         // greater than or equal would also work, but mean the fec step is called later than needed, introducing latency
         assert(nMissingPrimaryFragments==nAvailableSecondaryFragments);
-        auto recoveredFragmentIndices= fecDecode(sizeOfSecondaryFragments, blockBuffer, fec_k, fragment_map);
-        for(const auto idx:recoveredFragmentIndices){
-            fragment_map[idx]=AVAILABLE;
+        const int nRecoveredFragments= fecDecode(sizeOfSecondaryFragments, blockBuffer, fec_k, fragment_map);
+        // all primary fragments are available now
+        for(unsigned int idx=fragment_map.findFirstUnset(0,fec_k); idx<fec_k; idx=fragment_map.findFirstUnset(idx+1,fec_k)){
+            fragment_map.set(idx);
         }
-        nAvailablePrimaryFragments+=recoveredFragmentIndices.size();
+        nAvailablePrimaryFragments+=nRecoveredFragments;
+        assert(nAvailablePrimaryFragments==fec_k);
         // n of reconstructed packets
-        return recoveredFragmentIndices.size();
+        return nRecoveredFragments;
     }
     uint64_t getBlockIdx()const{
         return blockIdx;
@@ -382,11 +502,18 @@ private:
     // n of primary fragments that are already pulled out
     int nAlreadyForwardedPrimaryFragments=0;
     // for each fragment (via fragment_idx) store if it has been received yet
-    std::vector<FragmentStatus> fragment_map;
-    // holds all the data for all received fragments (if fragment_map says UNAVALIABLE at this position, content is undefined)
-    std::vector<std::array<uint8_t,FEC_MAX_PACKET_SIZE>> blockBuffer;
+    // (after creation of the RxBlock every fragment is marked as unavailable)
+    FragmentBitmap fragment_map;
+    // only used in unordered mode, where primary fragments are not forwarded strictly in order
+    FragmentBitmap primaryFragmentForwarded;
+    // holds all the data for all received fragments (if fragment_map is not set at this position, content is undefined)
+    std::vector<std::array<uint8_t,RX_BLOCK_FRAGMENT_BUFFER_SIZE>> blockBuffer;
     int nAvailablePrimaryFragments=0;
     int nAvailableSecondaryFragments=0;
+    // secondary fragments that are available, but still encrypted (they count as available secondary fragments, too)
+    FragmentBitmap encryptedFragments;
+    std::array<uint16_t,FragmentBitmap::N_BITS> encryptedFragmentSize{};
+    int nEncryptedSecondaryFragments=0;
     // time point when the first fragment for this block was received (via addFragment() )
     std::optional<std::chrono::steady_clock::time_point> firstFragmentTimePoint=std::nullopt;
     // we don't know how many primary fragments this block contains until we either receive the last primary fragment for this block
@@ -406,19 +533,44 @@ public:
     // Does not need to know k,n or if tx does variable block length or not.
     // If the tx doesn't use the full range of fragment indices (aka K is fixed) use
     // @param maxNFragmentsPerBlock for a more efficient memory usage
-    explicit FECDecoder(const unsigned int maxNFragmentsPerBlock=MAX_TOTAL_FRAGMENTS_PER_BLOCK):maxNFragmentsPerBlock(maxNFragmentsPerBlock){}
+    // @param enableEarlyGiveUp: The tx sends all fragments in strictly increasing nonce order. Assuming the rx card(s) do not re-order packets,
+    // a block can be given up as soon as it is provably unrecoverable, instead of waiting for a rx queue overflow.
+    // If enabled, make sure to pass the right rx card index with each packet.
+    // @param enableUnorderedOutput: Forward each primary fragment as soon as it is received, reconstructed primary fragments follow once the block
+    // has been recovered. Only use this if the consumer can handle re-ordered packets, but in exchange there is no head of line blocking at all.
+    // @param enableAdaptiveRxQueueSize: Instead of a fixed rx queue size, start with the default size and adapt it between
+    // RX_QUEUE_MIN_SIZE and RX_QUEUE_MAX_SIZE depending on the measured (block level) re-ordering between the rx cards.
+    explicit FECDecoder(const unsigned int maxNFragmentsPerBlock=MAX_TOTAL_FRAGMENTS_PER_BLOCK,const bool enableEarlyGiveUp=false,const bool enableUnorderedOutput=false,
+                        const bool enableAdaptiveRxQueueSize=false):
+        maxNFragmentsPerBlock(maxNFragmentsPerBlock),enableEarlyGiveUp(enableEarlyGiveUp),enableUnorderedOutput(enableUnorderedOutput),
+        enableAdaptiveRxQueueSize(enableAdaptiveRxQueueSize){}
     FECDecoder(const FECDecoder& other)=delete;
     ~FECDecoder() = default;
     // data forwarded on this callback is always in-order but possibly with gaps
+    // (unless unordered output is enabled, in which case packets can be re-ordered, but there are still no duplicates)
     typedef std::function<void(const uint8_t * payload,std::size_t payloadSize)> SEND_DECODED_PACKET;
     // WARNING: Don't forget to register this callback !
     SEND_DECODED_PACKET mSendDecodedPayloadCallback;
+    // Only needed if you use processEncryptedSecondaryFragment()
+    RxBlock::DECRYPT_IN_PLACE mDecryptFragmentCallback;
     // A value too high doesn't really give much benefit and increases memory usage
-    static constexpr auto RX_QUEUE_MAX_SIZE = 10;
+    static constexpr auto RX_QUEUE_DEFAULT_SIZE = 10;
+    // limits for the adaptive rx queue size
+    static constexpr auto RX_QUEUE_MIN_SIZE = 2;
+    static constexpr auto RX_QUEUE_MAX_SIZE = 32;
+    // if the rx queue size is adaptive, it is decreased by one if no premature overflow happened during this interval
+    static constexpr auto RX_QUEUE_SHRINK_INTERVAL=std::chrono::seconds(5);
+    // with early give up, a rx card whose newest fragment is more than this n of blocks behind the newest fragment of any other card
+    // is considered to have stopped receiving - it no longer holds back giving up on blocks until it receives data again
+    static constexpr auto EARLY_GIVE_UP_MAX_RX_CARD_LAG_BLOCKS=3;
     const unsigned int maxNFragmentsPerBlock;
+    const bool enableEarlyGiveUp;
+    const bool enableUnorderedOutput;
+    const bool enableAdaptiveRxQueueSize;
 public:
     // returns false if the packet fragment index doesn't match the set FEC parameters (which should never happen !)
-    bool validateAndProcessPacket(const uint64_t nonce, const std::vector<uint8_t>& decrypted){
+    // @param rxCardIdx the rx card this packet was received on, only needed if early give up is enabled
+    bool validateAndProcessPacket(const uint64_t nonce, const std::vector<uint8_t>& decrypted,const int rxCardIdx=0){
         // normal FEC processing
         const FECNonce fecNonce=fecNonceFrom(nonce);
 
@@ -431,10 +583,164 @@ public:
             std::cerr<<"invalid fragment_idx:"<<fecNonce.fragmentIdx<<"\n";
             return false;
         }
-        processFECBlockWitRxQueue(fecNonce, decrypted);
+        if(enableAdaptiveRxQueueSize){
+            shrinkRxQueueIfIdle();
+        }
+        if(enableUnorderedOutput){
+            processFECBlockUnordered(fecNonce, decrypted);
+        }else{
+            processFECBlockWitRxQueue(fecNonce, decrypted);
+        }
+        if(enableEarlyGiveUp){
+            updateLastFragmentForRxCard(rxCardIdx,fecNonce);
+            removeUnrecoverableBlocks();
+        }
+        return true;
+    }
+    // Lazy decryption: Most secondary fragments are never used (no packet loss, or the block is already complete / recovered),
+    // so there is no point in authenticating and decrypting them on arrival.
+    // @return true if the (still encrypted) secondary fragment has been consumed - either since it is not needed at all,
+    // or since it has been stored in its block and is decrypted once it is needed for the FEC step.
+    // Otherwise, decrypt it and pass it to validateAndProcessPacket() as usual.
+    // Since this data is not authenticated yet, it must never create new blocks, change k of a block or move the rx queue -
+    // it is only stored if its block already exists and k is known from an authenticated fragment.
+    bool processEncryptedSecondaryFragment(const uint64_t nonce,const uint8_t* encrypted,const std::size_t encryptedSize){
+        assert(mDecryptFragmentCallback);
+        const FECNonce fecNonce=fecNonceFrom(nonce);
+        if(fecNonce.flag!=1 || fecNonce.blockIdx > MAX_BLOCK_IDX || fecNonce.fragmentIdx>=maxNFragmentsPerBlock || encryptedSize>RX_BLOCK_FRAGMENT_BUFFER_SIZE){
+            return false;
+        }
+        auto found=std::find_if(rx_queue.begin(), rx_queue.end(),
+                                [&fecNonce](const std::unique_ptr<RxBlock>& block) { return block->getBlockIdx() == fecNonce.blockIdx;});
+        if(found==rx_queue.end()){
+            // already processed blocks are ignored anyways
+            if(last_known_block != (uint64_t) -1 && fecNonce.blockIdx <= last_known_block){
+                count_secondary_decrypt_skipped++;
+                return true;
+            }
+            return false;
+        }
+        RxBlock& block=**found;
+        if(block.hasEncryptedFragment(fecNonce)){
+            // Usually just the same fragment received by another rx card, which doesn't need any crypto
+            if(block.isSameEncryptedFragment(fecNonce.fragmentIdx,encrypted,encryptedSize)){
+                count_secondary_decrypt_skipped++;
+                return true;
+            }
+            // The copies differ, so the copy we already have might be forged, in which case it would prevent the authentic one from being used.
+            // Authenticate the existing copy now, and if it is forged, replace it with this one.
+            if(block.decryptSecondaryFragment(fecNonce.fragmentIdx,mDecryptFragmentCallback)){
+                count_secondary_decrypt_skipped++;
+                return true;
+            }
+            count_secondary_decrypt_failed++;
+        }
+        // already processed fragments are ignored anyways
+        if(block.hasFragment(fecNonce)){
+            count_secondary_decrypt_skipped++;
+            return true;
+        }
+        if(!block.isKnownK(fecNonce.number)){
+            return false;
+        }
+        block.addEncryptedSecondaryFragment(fecNonce,encrypted,encryptedSize);
+        if(enableUnorderedOutput){
+            onFragmentAddedUnordered(block,fecNonce);
+        }else{
+            onFragmentAddedWithRxQueue(block);
+        }
+        return true;
+    }
+    // Multiple rx cards usually receive the same fragment multiple times. Call this before decrypting a fragment to drop copies
+    // of fragments that have already been authenticated (and fragments for blocks that are already done) without any crypto.
+    // This is safe against forged headers, since everything that is dropped here would have been dropped after the decryption anyways -
+    // the only difference being that a forged duplicate is not reported as decryption error.
+    // @return true if the fragment has been dropped
+    bool dropAuthenticatedDuplicate(const uint64_t nonce,const int rxCardIdx=0){
+        const FECNonce fecNonce=fecNonceFrom(nonce);
+        if (fecNonce.blockIdx > MAX_BLOCK_IDX || fecNonce.fragmentIdx>=maxNFragmentsPerBlock) {
+            return false;
+        }
+        auto found=std::find_if(rx_queue.begin(), rx_queue.end(),
+                                [&fecNonce](const std::unique_ptr<RxBlock>& block) { return block->getBlockIdx() == fecNonce.blockIdx;});
+        if(found!=rx_queue.end()){
+            if(!(*found)->hasAuthenticatedFragment(fecNonce)){
+                return false;
+            }
+        }else{
+            if(last_known_block == (uint64_t) -1 || fecNonce.blockIdx > last_known_block){
+                return false;
+            }
+            // fragments for blocks that were removed due to a rx queue overflow are needed to adapt the rx queue size
+            if(enableAdaptiveRxQueueSize && std::find(overflowBlocks.begin(), overflowBlocks.end(), fecNonce.blockIdx)!=overflowBlocks.end()){
+                return false;
+            }
+        }
+        // same as for an authenticated duplicate. This is needed since the duplicates from the slowest rx card are exactly
+        // what the re-ordering and the early give up rely on
+        measureReorderDistance(fecNonce.blockIdx);
+        if(enableEarlyGiveUp){
+            updateLastFragmentForRxCard(rxCardIdx,fecNonce);
+            removeUnrecoverableBlocks();
+        }
+        count_duplicates_dropped_before_decryption++;
         return true;
     }
 private:
+    // for each rx card, the block and fragment idx of the "newest" fragment that was received on this card
+    struct LastReceivedFragment{
+        uint64_t blockIdx;
+        uint16_t fragmentIdx;
+    };
+    std::vector<std::optional<LastReceivedFragment>> lastFragmentPerRxCard;
+    void updateLastFragmentForRxCard(const int rxCardIdx,const FECNonce& fecNonce){
+        assert(rxCardIdx>=0);
+        if(rxCardIdx>=lastFragmentPerRxCard.size()){
+            lastFragmentPerRxCard.resize(rxCardIdx+1);
+        }
+        auto& last=lastFragmentPerRxCard[rxCardIdx];
+        // the card should never re-order packets, but if it does, don't go back
+        if(last==std::nullopt || fecNonce.blockIdx>last->blockIdx || (fecNonce.blockIdx==last->blockIdx && fecNonce.fragmentIdx>last->fragmentIdx)){
+            last=LastReceivedFragment{fecNonce.blockIdx,fecNonce.fragmentIdx};
+        }
+    }
+    // returns the n of fragments for this block that have been "passed over" by all active rx cards
+    // (a fragment that has not been received yet can only arrive if its index is bigger or equal than the returned value)
+    // A rx card is active if it has received data and does not lag behind the newest card by more than EARLY_GIVE_UP_MAX_RX_CARD_LAG_BLOCKS.
+    int getNFragmentsPassedOver(const uint64_t blockIdx)const{
+        std::optional<uint64_t> newestBlockIdx;
+        for(const auto& last:lastFragmentPerRxCard){
+            if(last!=std::nullopt && (newestBlockIdx==std::nullopt || last->blockIdx>*newestBlockIdx)){
+                newestBlockIdx=last->blockIdx;
+            }
+        }
+        if(newestBlockIdx==std::nullopt)return 0;
+        int ret=maxNFragmentsPerBlock;
+        for(const auto& last:lastFragmentPerRxCard){
+            if(last==std::nullopt || *newestBlockIdx-last->blockIdx>EARLY_GIVE_UP_MAX_RX_CARD_LAG_BLOCKS)continue;
+            if(last->blockIdx<blockIdx)return 0;
+            if(last->blockIdx==blockIdx){
+                ret=std::min(ret,last->fragmentIdx+1);
+            }
+        }
+        return ret;
+    }
+    // Starting at the oldest block, remove all blocks where either all fragments have been passed over by all active rx cards,
+    // or (once k is known) the received fragments plus the fragments that can still arrive are less than k.
+    // Since these blocks are still in the queue they are neither complete nor recoverable, and never will be.
+    // Then forward the primary fragments of the new front block that were only waiting on them
+    void removeUnrecoverableBlocks(){
+        int nBlocksToRemove=0;
+        while(nBlocksToRemove<rx_queue.size()){
+            const RxBlock& block=*rx_queue[nBlocksToRemove];
+            const int nPassedOver=getNFragmentsPassedOver(block.getBlockIdx());
+            if(nPassedOver<maxNFragmentsPerBlock && !block.isUnrecoverable(nPassedOver)){
+                break;
+            }
+            nBlocksToRemove++;
+        }
+        giveUpOnOldestBlocks(nBlocksToRemove);
+    }
     // since we also need to search this data structure, a std::queue is not enough.
     // since we have an upper limit on the size of this dequeue, it is basically a searchable ring buffer
     std::deque<std::unique_ptr<RxBlock>> rx_queue;
@@ -448,7 +754,8 @@ private:
      */
     void forwardMissingPrimaryFragmentsIfAvailable(RxBlock& block, const bool discardMissingPackets= false)const{
         assert(mSendDecodedPayloadCallback);
-        const auto indices=block.pullAvailablePrimaryFragments(discardMissingPackets);
+        // in unordered mode, there are no gaps to wait on, and whatever is available has already been forwarded
+        const auto indices=enableUnorderedOutput ? block.pullAvailablePrimaryFragmentsUnordered() : block.pullAvailablePrimaryFragments(discardMissingPackets);
         for(auto primaryFragmentIndex:indices){
             const uint8_t* primaryFragment= block.getDataPrimaryFragment(primaryFragmentIndex);
             const FECPayloadHdr &packet_hdr = *(FECPayloadHdr*) primaryFragment;
@@ -469,8 +776,35 @@ private:
         if(!rx_queue.front()->allPrimaryFragmentsHaveBeenForwarded()){
             count_blocks_lost++;
         }
+        count_secondary_decrypt_skipped+=rx_queue.front()->getNEncryptedSecondaryFragments();
         rx_queue.pop_front();
     }
+    // Forward whatever is available for the @param nBlocks oldest blocks (the missing fragments are lost) and remove them.
+    // Then forward the primary fragments of the new front block that were only held back by the removed block(s).
+    void giveUpOnOldestBlocks(const int nBlocks){
+        if(nBlocks==0)return;
+        for(int i=0;i<nBlocks;i++){
+            forwardMissingPrimaryFragmentsIfAvailable(*rx_queue.front(), true);
+            rxQueuePopFront();
+        }
+        if(!rx_queue.empty()){
+            forwardMissingPrimaryFragmentsIfAvailable(*rx_queue.front());
+            if(rx_queue.front()->allPrimaryFragmentsHaveBeenForwarded()){
+                rxQueuePopFront();
+            }
+        }
+    }
+    // same as above, but for any block in the queue (only used in unordered mode, where blocks can be finished in any order)
+    void rxQueueRemove(const RxBlock& block){
+        auto found=std::find_if(rx_queue.begin(), rx_queue.end(),
+                                [&block](const std::unique_ptr<RxBlock>& other) { return *other == block;});
+        assert(found!=rx_queue.end());
+        if(!(*found)->allPrimaryFragmentsHaveBeenForwarded()){
+            count_blocks_lost++;
+        }
+        count_secondary_decrypt_skipped+=(*found)->getNEncryptedSecondaryFragments();
+        rx_queue.erase(found);
+    }
     // create a new RxBlock for the specified block_idx and push it into the queue
     // NOTE: Checks first if this operation would increase the size of the queue over its max capacity
     // In this case, the only solution is to remove the oldest block before adding the new one
@@ -479,13 +813,14 @@ private:
         if(!rx_queue.empty()){
             // the newest block in the queue should be equal to block_idx -1
             // but it must not ?!
-            if(rx_queue.back()->getBlockIdx() != (blockIdx-1)){
+            // (in unordered mode, the newest block might have already been finished and removed)
+            if(!enableUnorderedOutput && rx_queue.back()->getBlockIdx() != (blockIdx-1)){
                 std::cout<<"In queue:"<<rx_queue.back()->getBlockIdx()<<" But new:"<<blockIdx<<"\n";
             }
             //assert(rx_queue.back()->getBlockIdx() == (blockIdx - 1));
         }
         // we can return early if this operation doesn't exceed the size limit
-        if(rx_queue.size() < RX_QUEUE_MAX_SIZE){
+        if(rx_queue.size() < rxQueueSize){
             rx_queue.push_back(std::make_unique<RxBlock>(maxNFragmentsPerBlock,blockIdx));
             count_blocks_total++;
             return;
@@ -496,12 +831,19 @@ private:
         //   Some cards can do this due to packet reordering inside, diffent chipset and/or firmware or your RX hosts have different CPU power.
         //2. Reduce packet injection speed or try to unify RX hardware.
 
-        // forward remaining data for the (oldest) block, since we need to get rid of it
-        auto& oldestBlock=rx_queue.front();
-        std::cerr<<"Forwarding block that is not yet fully finished "<<oldestBlock->getBlockIdx()<<" with n fragments"<<oldestBlock->getNAvailableFragments()<<"\n";
-        forwardMissingPrimaryFragmentsIfAvailable(*oldestBlock, true);
-        // and remove the block once done with it
-        rxQueuePopFront();
+        // forward remaining data for the (oldest) block(s), since we need to get rid of it
+        // (more than one block is removed if the adaptive rx queue size has just been decreased)
+        while(rx_queue.size()>=rxQueueSize){
+            auto& oldestBlock=rx_queue.front();
+            std::cerr<<"Forwarding block that is not yet fully finished "<<oldestBlock->getBlockIdx()<<" with n fragments"<<oldestBlock->getNAvailableFragments()<<"\n";
+            forwardMissingPrimaryFragmentsIfAvailable(*oldestBlock, true);
+            count_rx_queue_overflow++;
+            if(enableAdaptiveRxQueueSize){
+                rememberOverflowBlock(oldestBlock->getBlockIdx());
+            }
+            // and remove the block once done with it
+            rxQueuePopFront();
+        }
 
         // now we are guaranteed to have space for one new block
         rx_queue.push_back(std::make_unique<RxBlock>(maxNFragmentsPerBlock,blockIdx));
@@ -511,7 +853,16 @@ private:
     // If block is already known and not in the queue anymore return nullptr
     // else if block is inside the ring return pointer to it
     // and if it is not inside the ring add as many blocks as needed, then return pointer to it
+    // measure the (block level) re-ordering, e.g. how far this block is behind the newest known block
+    void measureReorderDistance(const uint64_t blockIdx){
+        if(last_known_block != (uint64_t) -1 && blockIdx < last_known_block){
+            const int reorderDistance=(int)std::min(last_known_block-blockIdx,(uint64_t)RX_QUEUE_MAX_SIZE);
+            max_reorder_distance=std::max(max_reorder_distance,reorderDistance);
+            maxReorderDistanceSinceLastShrink=std::max(maxReorderDistanceSinceLastShrink,reorderDistance);
+        }
+    }
     RxBlock* rxRingFindCreateBlockByIdx(const uint64_t blockIdx) {
+        measureReorderDistance(blockIdx);
         // check if block is already in the ring
         auto found=std::find_if(rx_queue.begin(), rx_queue.end(),
                                 [&blockIdx](const std::unique_ptr<RxBlock>& block) { return block->getBlockIdx() == blockIdx;});
@@ -520,13 +871,16 @@ private:
         }
         // check if block is already known and not in the ring then it is already processed
         if (last_known_block != (uint64_t) -1 && blockIdx <= last_known_block) {
+            if(enableAdaptiveRxQueueSize){
+                growRxQueueIfOverflowWasPremature(blockIdx);
+            }
             return nullptr;
         }
 
         // add as many blocks as we need ( the rx ring mustn't have any gaps between the block indices).
         // but there is no point in adding more blocks than RX_RING_SIZE
         const int new_blocks = (int) std::min(last_known_block != (uint64_t) -1 ? blockIdx - last_known_block : 1,
-                                              (uint64_t) FECDecoder::RX_QUEUE_MAX_SIZE);
+                                              (uint64_t) rxQueueSize);
         last_known_block = blockIdx;
 
         for(int i=0;i<new_blocks;i++){
@@ -549,7 +903,9 @@ private:
             return;
         }
         block.addFragment(fecNonce, decrypted.data(), decrypted.size());
-        //
+        onFragmentAddedWithRxQueue(block);
+    }
+    void onFragmentAddedWithRxQueue(RxBlock& block){
         if (block == *rx_queue.front()) {
             //std::cout<<"In front\n";
             // we are in the front of the queue (e.g. at the oldest block)
@@ -561,7 +917,7 @@ private:
                 rxQueuePopFront();
                 return;
             }
-            if(block.allPrimaryFragmentsCanBeRecovered()){
+            if(canBeRecoveredDecryptIfNeeded(block)){
                 count_fragments_recovered+=block.reconstructAllMissingData();
                 count_blocks_recovered++;
                 forwardMissingPrimaryFragmentsIfAvailable(block);
@@ -575,7 +931,7 @@ private:
             //std::cout<<"Not in front\n";
             // we are not in the front of the queue but somewhere else
             // If this block can be fully recovered or all primary fragments are available this triggers a flush
-            if(block.allPrimaryFragmentsAreAvailable() || block.allPrimaryFragmentsCanBeRecovered()){
+            if(block.allPrimaryFragmentsAreAvailable() || canBeRecoveredDecryptIfNeeded(block)){
                 // send all queued packets in all unfinished blocks before and remove them
                 while(block != *rx_queue.front()){
                     forwardMissingPrimaryFragmentsIfAvailable(*rx_queue.front(), true);
@@ -597,7 +953,86 @@ private:
             }
         }
     }
+    // Unordered mode: forward each primary fragment immediately, and since there is nothing to wait on,
+    // a block is done as soon as all its primary fragments have been received or recovered - older unfinished blocks stay in the queue
+    // and can still be recovered.
+    void processFECBlockUnordered(const FECNonce& fecNonce, const std::vector<uint8_t>& decrypted){
+        auto blockP= rxRingFindCreateBlockByIdx(fecNonce.blockIdx);
+        //ignore already processed blocks
+        if (blockP==nullptr) return;
+        RxBlock& block = *blockP;
+        // ignore already processed fragments
+        if(block.hasFragment(fecNonce)){
+            return;
+        }
+        block.addFragment(fecNonce, decrypted.data(), decrypted.size());
+        onFragmentAddedUnordered(block,fecNonce);
+    }
+    void onFragmentAddedUnordered(RxBlock& block,const FECNonce& fecNonce){
+        if(fecNonce.flag==0){
+            forwardMissingPrimaryFragmentsIfAvailable(block);
+        }
+        if(block.allPrimaryFragmentsHaveBeenForwarded()){
+            rxQueueRemove(block);
+            return;
+        }
+        if(canBeRecoveredDecryptIfNeeded(block)){
+            count_fragments_recovered+=block.reconstructAllMissingData();
+            count_blocks_recovered++;
+            // forwards only the reconstructed ones
+            forwardMissingPrimaryFragmentsIfAvailable(block);
+            assert(block.allPrimaryFragmentsHaveBeenForwarded());
+            rxQueueRemove(block);
+        }
+    }
+    // Returns true if enough secondary fragments are available to recover the block. Secondary fragments that are still encrypted
+    // are decrypted first - if any of them turns out not to be authentic, it is removed and the block might not be recoverable (yet).
+    bool canBeRecoveredDecryptIfNeeded(RxBlock& block){
+        if(!block.allPrimaryFragmentsCanBeRecovered())return false;
+        if(block.getNEncryptedSecondaryFragments()==0)return true;
+        count_secondary_decrypt_failed+=block.decryptSecondaryFragments(mDecryptFragmentCallback);
+        return block.allPrimaryFragmentsCanBeRecovered();
+    }
+    // current size limit of the rx queue (fixed unless adaptive rx queue size is enabled)
+    int rxQueueSize=RX_QUEUE_DEFAULT_SIZE;
+    // the most recent block indices that were removed due to a rx queue overflow
+    std::deque<uint64_t> overflowBlocks;
+    int maxReorderDistanceSinceLastShrink=0;
+    std::chrono::steady_clock::time_point lastRxQueueSizeChange=std::chrono::steady_clock::now();
+    void rememberOverflowBlock(const uint64_t blockIdx){
+        overflowBlocks.push_back(blockIdx);
+        if(overflowBlocks.size()>RX_QUEUE_MAX_SIZE){
+            overflowBlocks.pop_front();
+        }
+    }
+    // A fragment for a block that has been removed due to a rx queue overflow arrived - it would have been useful with a bigger queue
+    void growRxQueueIfOverflowWasPremature(const uint64_t blockIdx){
+        if(std::find(overflowBlocks.begin(), overflowBlocks.end(), blockIdx)==overflowBlocks.end())return;
+        const int neededSize=(int)std::min(last_known_block-blockIdx+1,(uint64_t)RX_QUEUE_MAX_SIZE);
+        if(neededSize>rxQueueSize){
+            std::cout<<"Increasing rx queue size from "<<rxQueueSize<<" to "<<neededSize<<"\n";
+            rxQueueSize=neededSize;
+        }
+        lastRxQueueSizeChange=std::chrono::steady_clock::now();
+        maxReorderDistanceSinceLastShrink=0;
+    }
+    // Decrease the rx queue size by one if there was no premature overflow for a while,
+    // but never below what was needed for the re-ordering measured during this time
+    void shrinkRxQueueIfIdle(){
+        const auto now=std::chrono::steady_clock::now();
+        if(now-lastRxQueueSizeChange<RX_QUEUE_SHRINK_INTERVAL)return;
+        const int newSize=std::max({rxQueueSize-1,maxReorderDistanceSinceLastShrink+1,RX_QUEUE_MIN_SIZE});
+        if(newSize<rxQueueSize){
+            std::cout<<"Decreasing rx queue size from "<<rxQueueSize<<" to "<<newSize<<"\n";
+            rxQueueSize=newSize;
+        }
+        lastRxQueueSizeChange=now;
+        maxReorderDistanceSinceLastShrink=0;
+    }
 public:
+    int getRxQueueSize()const{
+        return rxQueueSize;
+    }
     void decreaseRxRingSize(int newSize){
         std::cout << "Decreasing ring size from " << rx_queue.size() << "to " << newSize << "\n";
         while(rx_queue.size() >newSize){
@@ -611,19 +1046,27 @@ public:
     void flushRxRing(){
        decreaseRxRingSize(0);
     }
-    //TODO maybe this would make sense
-    void removeBlocksOlderThan(const std::chrono::steady_clock::duration& maxDelta){
+    // Give up on all blocks where the first fragment was received more than @param maxDelta ago.
+    // Since blocks are always forwarded in order, this also removes all (older) blocks in front of the "newest" block that is too old.
+    // Whatever data is available for these blocks is forwarded, the missing fragments are lost (and the block counts as lost).
+    // This puts an upper bound on the latency the rx queue can create, for example when the tx data rate is low and no new blocks arrive that would trigger a flush.
+    // @return the n of removed blocks
+    int removeBlocksOlderThan(const std::chrono::steady_clock::duration& maxDelta){
         // if there is any, find the "newest" block which age is bigger than delta
         const auto now=std::chrono::steady_clock::now();
-        for(auto& block:rx_queue){
-            const auto firstFragmentTimePoint=block->getFirstFragmentTimePoint();
+        int nBlocksToRemove=0;
+        for(int i=0;i<rx_queue.size();i++){
+            const auto firstFragmentTimePoint=rx_queue[i]->getFirstFragmentTimePoint();
             if(firstFragmentTimePoint!=std::nullopt){
                 const auto delta=now-*firstFragmentTimePoint;
                 if(delta>maxDelta){
-                    //std::cout<<"Got block"<<block->getBlockIdx()<<" with age"<<MyTimeHelper::R(delta)<<"\n";
+                    //std::cout<<"Got block"<<rx_queue[i]->getBlockIdx()<<" with age"<<MyTimeHelper::R(delta)<<"\n";
+                    nBlocksToRemove=i+1;
                 }
             }
         }
+        giveUpOnOldestBlocks(nBlocksToRemove);
+        return nBlocksToRemove;
     }
 public:
     // total block count
@@ -634,6 +1077,16 @@ public:
     uint64_t count_blocks_recovered=0;
     // n of primary fragments that were reconstructed during the recovery process of a block
     uint64_t count_fragments_recovered=0;
+    // n of blocks that had to be removed (while not yet finished) because the rx queue was full
+    uint64_t count_rx_queue_overflow=0;
+    // the biggest difference between the newest known block and the block of a received fragment, capped at RX_QUEUE_MAX_SIZE
+    int max_reorder_distance=0;
+    // n of secondary fragments that were never decrypted since they were not needed (see processEncryptedSecondaryFragment() )
+    uint64_t count_secondary_decrypt_skipped=0;
+    // n of (lazily decrypted) secondary fragments that turned out not to be authentic
+    uint64_t count_secondary_decrypt_failed=0;
+    // n of fragments dropped by dropAuthenticatedDuplicate()
+    uint64_t count_duplicates_dropped_before_decryption=0;
 };
 
 // quick math regarding sequence numbers:
@@ -0,0 +1,56 @@
+#ifndef WIFIBROADCAST_FRAMEQUEUE_HPP
+#define WIFIBROADCAST_FRAMEQUEUE_HPP
+
+#include <atomic>
+#include <cstddef>
+#include <vector>
+
+// Single producer single consumer queue of frames, each frame is a @param Frame (e.g. a buffer for the packet and its metadata).
+// The slots are allocated once, frames are written and read in place.
+// Lock free: only the producer writes writeIdx, only the consumer writes readIdx.
+template<class Frame>
+class FrameQueue{
+public:
+    explicit FrameQueue(const std::size_t capacity):slots(capacity+1){}
+    // Producer: @return the slot to write the next frame into, nullptr if the queue is full
+    Frame* beginWrite(){
+        const auto w=writeIdx.load(std::memory_order_relaxed);
+        if(next(w)==readIdx.load(std::memory_order_acquire))return nullptr;
+        return &slots[w];
+    }
+    // Producer: make the frame returned by beginWrite() visible to the consumer
+    void commitWrite(){
+        const auto w=writeIdx.load(std::memory_order_relaxed);
+        writeIdx.store(next(w),std::memory_order_release);
+    }
+    // Consumer: @return the oldest frame, nullptr if the queue is empty
+    Frame* front(){
+        const auto r=readIdx.load(std::memory_order_relaxed);
+        if(r==writeIdx.load(std::memory_order_acquire))return nullptr;
+        return &slots[r];
+    }
+    // Consumer: release the frame returned by front()
+    void pop(){
+        const auto r=readIdx.load(std::memory_order_relaxed);
+        readIdx.store(next(r),std::memory_order_release);
+    }
+    // n of frames in the queue (approximate if called while the other thread is active)
+    std::size_t size()const{
+        const auto w=writeIdx.load(std::memory_order_acquire);
+        const auto r=readIdx.load(std::memory_order_acquire);
+        return w>=r ? w-r : slots.size()-r+w;
+    }
+    std::size_t capacity()const{
+        return slots.size()-1;
+    }
+private:
+    std::vector<Frame> slots;
+    // on separate cache lines, since they are written by different threads
+    alignas(64) std::atomic<std::size_t> writeIdx{0};
+    alignas(64) std::atomic<std::size_t> readIdx{0};
+    std::size_t next(const std::size_t idx)const{
+        return (idx+1)==slots.size() ? 0 : idx+1;
+    }
+};
+
+#endif //WIFIBROADCAST_FRAMEQUEUE_HPP
@@ -25,7 +25,7 @@
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <netinet/ether.h>
-#include <netpacket/packet.h>
+#include <linux/if_packet.h>
 #include <termio.h>
 #include <sys/ioctl.h>
 #include <net/if.h>
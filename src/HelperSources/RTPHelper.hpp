@@ -25,7 +25,7 @@
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <netinet/ether.h>
-#include <netpacket/packet.h>
+#include <linux/if_packet.h>
 #include <termio.h>
 #include <sys/ioctl.h>
 #include <net/if.h>
@@ -126,6 +126,34 @@ namespace RTPLockup{
             return true;
         }
     }
+    // returns true if the rtp h264 packet belongs to a NALU no other frame references (nal_ref_idc==0), which makes it
+    // the cheapest to drop. The FU indicator of fragmented NALUs carries the nal_ref_idc of the original NALU.
+    static bool h264_is_non_reference(const uint8_t* payload, const std::size_t payloadSize){
+        if(payloadSize<RTP_HEADER_SIZE+sizeof(H264::nalu_header_t)){
+            return false;
+        }
+        const H264::nalu_header_t& naluHeader=*(H264::nalu_header_t*)(&payload[RTP_HEADER_SIZE]);
+        if(naluHeader.type == 28 || (naluHeader.type>0 && naluHeader.type<24)){
+            return naluHeader.nri==0;
+        }
+        return false;
+    }
+    // same for h265: the sub-layer non-reference VCL NALU types are the even ones below 16 (TRAIL_N, TSA_N, STSA_N, RADL_N, RASL_N,...)
+    static bool h265_is_non_reference(const uint8_t* payload, const std::size_t payloadSize){
+        if(payloadSize<RTP_HEADER_SIZE+sizeof(H265::nal_unit_header_h265_t)){
+            return false;
+        }
+        const H265::nal_unit_header_h265_t& naluHeader=*(H265::nal_unit_header_h265_t*)(&payload[RTP_HEADER_SIZE]);
+        int type=naluHeader.type;
+        if(type==49){
+            if(payloadSize<RTP_HEADER_SIZE+sizeof(H265::nal_unit_header_h265_t)+sizeof(H265::fu_header_h265_t)){
+                return false;
+            }
+            const H265::fu_header_h265_t& fuHeader=*(H265::fu_header_h265_t*)&payload[RTP_HEADER_SIZE+sizeof(H265::nal_unit_header_h265_t)];
+            type=fuHeader.fuType;
+        }
+        return type<16 && (type%2)==0;
+    }
     static bool mjpeg_end_block(const uint8_t* payload, const std::size_t payloadSize){
         // TODO not yet supported
         return false;
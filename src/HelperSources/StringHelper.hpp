@@ -8,6 +8,7 @@
 #include <string>
 #include <sstream>
 #include <vector>
+#include <array>
 #include <cmath>
 #include <iomanip>
 #include <cassert>
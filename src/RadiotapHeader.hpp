@@ -27,6 +27,9 @@ extern "C"{
 #include <sstream>
 #include <iostream>
 #include <cassert>
+#include <algorithm>
+#include <array>
+#include <optional>
 
 // everything must be in little endian byte order http://www.radiotap.org/
 static_assert(__BYTE_ORDER == __LITTLE_ENDIAN,"This code is written for little endian only !");
@@ -146,6 +149,23 @@ public:
                assert(true);
         }
     };
+    // Inverse of the constructor
+    // @return the params of a radiotap header that was created by this class, std::nullopt if @param data is something else
+    static std::optional<UserSelectableParams> parseUserSelectableParams(const uint8_t* data,const std::size_t dataSize){
+        if(dataSize<SIZE_BYTES)return std::nullopt;
+        RadiotapHeaderWithTxFlagsAndMCS header;
+        memcpy(&header,data,SIZE_BYTES);
+        if(header.length!=SIZE_BYTES || header.presence!=Radiotap::writePresenceBitfield({IEEE80211_RADIOTAP_TX_FLAGS, IEEE80211_RADIOTAP_MCS})){
+            return std::nullopt;
+        }
+        UserSelectableParams params;
+        params.bandwidth= (header.mcs.flags & IEEE80211_RADIOTAP_MCS_BW_MASK)==IEEE80211_RADIOTAP_MCS_BW_40 ? 40 : 20;
+        params.short_gi= (header.mcs.flags & IEEE80211_RADIOTAP_MCS_SGI)!=0;
+        params.stbc= (header.mcs.flags & IEEE80211_RADIOTAP_MCS_STBC_MASK) >> IEEE80211_RADIOTAP_MCS_STBC_SHIFT;
+        params.ldpc= (header.mcs.flags & IEEE80211_RADIOTAP_MCS_FEC_LDPC)!=0;
+        params.mcs_index=header.mcs.modulationIndex;
+        return params;
+    }
     const uint8_t* getData()const{
         return (const uint8_t*)&radiotapHeaderData;
     }
@@ -158,6 +178,40 @@ private:
 static_assert(sizeof(RadiotapHeader) == RadiotapHeader::SIZE_BYTES, "ALWAYS TRUE");
 static_assert(sizeof(RadiotapHeaderWithTxFlagsAndMCS) == RadiotapHeader::SIZE_BYTES, "ALWAYS TRUE");
 
+// Estimate how long a frame occupies the medium, for the 802.11n (HT mixed format, one spatial stream) rates
+// selectable via RadiotapHeader::UserSelectableParams.
+namespace Airtime{
+    // data bits per OFDM symbol for MCS 0..7, 20MHz and 40MHz
+    static constexpr std::array<int,8> N_DBPS_20MHZ={26,52,78,104,156,208,234,260};
+    static constexpr std::array<int,8> N_DBPS_40MHZ={54,108,162,216,324,432,486,540};
+    // L-STF + L-LTF + L-SIG + HT-SIG + HT-STF, without the HT-LTF(s)
+    static constexpr auto PREAMBLE_US=32;
+    static constexpr auto HT_LTF_US=4;
+    // we never wait for an ACK, but each frame has to wait for DIFS and (on average) half the min contention window
+    // (5GHz OFDM timings: SIFS=16us, slot=9us, CWmin=15)
+    static constexpr double MEDIUM_ACCESS_US=16+2*9+7.5*9;
+    static constexpr auto FCS_SIZE=4;
+    /**
+     * @param ieee80211FrameSize size of the frame without the radiotap header (IEEE80211 header and payload, the FCS is added)
+     * @return the estimated time on air, including the medium access overhead
+     */
+    static std::chrono::nanoseconds calculateAirtime(const RadiotapHeader::UserSelectableParams& params,const std::size_t ieee80211FrameSize){
+        const int mcs=std::clamp(params.mcs_index,0,7);
+        const int nDbps= params.bandwidth==40 ? N_DBPS_40MHZ[mcs] : N_DBPS_20MHZ[mcs];
+        // SERVICE (16) + data + tail (6) bits
+        const std::size_t nBits=16+8*(ieee80211FrameSize+FCS_SIZE)+6;
+        std::size_t nSymbols=(nBits+nDbps-1)/nDbps;
+        // with STBC, one stream is sent as two space time streams (n of symbols has to be even, one more HT-LTF)
+        if(params.stbc>0 && (nSymbols%2)!=0){
+            nSymbols++;
+        }
+        const double symbolUs= params.short_gi ? 3.6 : 4.0;
+        const int nHtLtf= params.stbc>0 ? 2 : 1;
+        const double airtimeUs=MEDIUM_ACCESS_US+PREAMBLE_US+nHtLtf*HT_LTF_US+nSymbols*symbolUs;
+        return std::chrono::nanoseconds((int64_t)(airtimeUs*1000.0));
+    }
+}
+
 
 namespace RadiotapHelper{
     std::string toStringRadiotapFlags(uint8_t flags){
@@ -18,6 +18,14 @@
 #include <arpa/inet.h>
 #include <pcap/pcap.h>
 #include <poll.h>
+#include <optional>
+#include <linux/filter.h>
+#include <linux/if_ether.h>
+#include <net/if.h>
+#include <net/if_arp.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <unistd.h>
 
 // This is a single header-only file you can use to build your own wifibroadcast link
 // It doesn't specify if / what FEC to use and so on
@@ -40,8 +48,31 @@ namespace RawReceiverHelper{
         }
         pcap_free_tstamp_types(availableTimestamps);
     }
+    // use as radio port to receive the packets of all radio ports (e.g. to demultiplex them in the application)
+    static constexpr int ALL_RADIO_PORTS=-1;
+    // the filter that only lets wifibroadcast packets for the selected radio port (or all radio ports) pass
+    static std::string createBpfProgram(const std::string& wlan,const int link_encap,const int radio_port){
+        std::string program;
+        switch (link_encap) {
+            case DLT_PRISM_HEADER:
+                std::cout<<wlan<<" has DLT_PRISM_HEADER Encap\n";
+                program = radio_port==ALL_RADIO_PORTS ? std::string("radio[0x4a:4]==0x13223344 && radio[0x4e:1] == 0x55") :
+                        StringFormat::convert("radio[0x4a:4]==0x13223344 && radio[0x4e:2] == 0x55%.2x", radio_port);
+                break;
+
+            case DLT_IEEE802_11_RADIO:
+                std::cout<<wlan<<" has DLT_IEEE802_11_RADIO Encap\n";
+                program = radio_port==ALL_RADIO_PORTS ? std::string("ether[0x0a:4]==0x13223344 && ether[0x0e:1] == 0x55") :
+                        StringFormat::convert("ether[0x0a:4]==0x13223344 && ether[0x0e:2] == 0x55%.2x", radio_port);
+                break;
+            default:
+                throw std::runtime_error(StringFormat::convert("unknown encapsulation on %s", wlan.c_str()));
+        }
+        return program;
+    }
     // copy paste from svpcom
     // I think this one opens the rx interface with pcap and then sets a filter such that only packets pass through for the selected radio port
+    // (or for any radio port if @param radio_port==ALL_RADIO_PORTS, in this case only the wifibroadcast MAC is checked)
     static pcap_t* openRxWithPcap(const std::string& wlan,const int radio_port){
         pcap_t* ppcap;
         char errbuf[PCAP_ERRBUF_SIZE];
@@ -63,20 +94,7 @@ namespace RawReceiverHelper{
 
         int link_encap = pcap_datalink(ppcap);
         struct bpf_program bpfprogram{};
-        std::string program;
-        switch (link_encap) {
-            case DLT_PRISM_HEADER:
-                std::cout<<wlan<<" has DLT_PRISM_HEADER Encap\n";
-                program = StringFormat::convert("radio[0x4a:4]==0x13223344 && radio[0x4e:2] == 0x55%.2x", radio_port);
-                break;
-
-            case DLT_IEEE802_11_RADIO:
-                std::cout<<wlan<<" has DLT_IEEE802_11_RADIO Encap\n";
-                program = StringFormat::convert("ether[0x0a:4]==0x13223344 && ether[0x0e:2] == 0x55%.2x", radio_port);
-                break;
-            default:
-                throw std::runtime_error(StringFormat::convert("unknown encapsulation on %s", wlan.c_str()));
-        }
+        const std::string program=createBpfProgram(wlan,link_encap,radio_port);
         if (pcap_compile(ppcap, &bpfprogram, program.c_str(), 1, 0) == -1) {
             throw std::runtime_error(StringFormat::convert("Unable to compile %s: %s", program.c_str(), pcap_geterr(ppcap)));
         }
@@ -86,6 +104,45 @@ namespace RawReceiverHelper{
         pcap_freecode(&bpfprogram);
         return ppcap;
     }
+    // @return the pcap link type of @param wlan (the one pcap_datalink() would return after opening it)
+    static int getLinkEncap(const int sockFd,const std::string& wlan){
+        ifreq ifr{};
+        strncpy(ifr.ifr_name,wlan.c_str(),IFNAMSIZ-1);
+        if(ioctl(sockFd,SIOCGIFHWADDR,&ifr)<0){
+            throw std::runtime_error(StringFormat::convert("Unable to get link type of %s: %s", wlan.c_str(), strerror(errno)));
+        }
+        switch (ifr.ifr_hwaddr.sa_family) {
+            case ARPHRD_IEEE80211_PRISM:
+                return DLT_PRISM_HEADER;
+            case ARPHRD_IEEE80211_RADIOTAP:
+                return DLT_IEEE802_11_RADIO;
+            default:
+                throw std::runtime_error(StringFormat::convert("unknown encapsulation on %s", wlan.c_str()));
+        }
+    }
+    // Compile the same filter as openRxWithPcap() and attach it to the AF_PACKET socket @param sockFd
+    static void attachBpfFilter(const int sockFd,const std::string& wlan,const int radio_port){
+        const int link_encap=getLinkEncap(sockFd,wlan);
+        const std::string program=createBpfProgram(wlan,link_encap,radio_port);
+        pcap_t* ppcap=pcap_open_dead(link_encap,4096);
+        if (ppcap == NULL) {
+            throw std::runtime_error(StringFormat::convert("pcap_open_dead failed on %s", wlan.c_str()));
+        }
+        struct bpf_program bpfprogram{};
+        if (pcap_compile(ppcap, &bpfprogram, program.c_str(), 1, 0) == -1) {
+            const std::string error=pcap_geterr(ppcap);
+            pcap_close(ppcap);
+            throw std::runtime_error(StringFormat::convert("Unable to compile %s: %s", program.c_str(), error.c_str()));
+        }
+        // struct bpf_insn and struct sock_filter have the same layout
+        const sock_fprog filter{(unsigned short)bpfprogram.bf_len,(sock_filter*)bpfprogram.bf_insns};
+        const int result=setsockopt(sockFd,SOL_SOCKET,SO_ATTACH_FILTER,&filter,sizeof(filter));
+        pcap_freecode(&bpfprogram);
+        pcap_close(ppcap);
+        if(result!=0){
+            throw std::runtime_error(StringFormat::convert("Unable to set filter %s: %s", program.c_str(), strerror(errno)));
+        }
+    }
     struct RssiForAntenna{
         // which antenna the value refers to
         const uint8_t antennaIdx;
@@ -177,18 +234,36 @@ namespace RawReceiverHelper{
         const std::size_t payloadSize=(std::size_t)pktlen-Ieee80211Header::SIZE_BYTES;
         return ParsedRxPcapPacket{allAntennaValues,ieee80211Header,payload,payloadSize,frameFailedFcsCheck};
     }
+    // Returns the radio port of a packet without parsing the whole radiotap header (only its length),
+    // std::nullopt if the packet is too short
+    static std::optional<uint8_t> peekRadioPort(const pcap_pkthdr& hdr, const uint8_t *pkt){
+        // it_version, it_pad, it_len (little endian)
+        if(hdr.caplen<4)return std::nullopt;
+        const std::size_t radiotapHeaderLength=pkt[2] | (pkt[3]<<8);
+        if(hdr.caplen<radiotapHeaderLength+Ieee80211Header::SIZE_BYTES)return std::nullopt;
+        return ((const Ieee80211Header*)(pkt+radiotapHeaderLength))->getRadioPort();
+    }
 }
 
-// This class listens for WIFI data on the specified wlan for wifi packets with the right RADIO_PORT
+// Listens for WIFI data on one wlan for wifi packets with the right RADIO_PORT
 // Processing of data is done by the callback
 // It uses a slightly complicated pattern:
 // 1) check if data is available via the fd
 // 2) then call loop_iter().
 // loop_iter loops over all packets for this wifi card that are not processed yet, then returns.
-class PcapReceiver {
+class IRawReceiver{
 public:
-    // this callback is called with the received packet from pcap
+    // this callback is called with the received packet (including the radiotap header)
     typedef std::function<void(const uint8_t wlan_idx,const pcap_pkthdr& hdr,const uint8_t* pkt)> PROCESS_PACKET_CALLBACK;
+    // @return the n of processed packets
+    virtual int loop_iter()=0;
+    virtual int getfd()const=0;
+    virtual ~IRawReceiver()=default;
+};
+
+// IRawReceiver using pcap
+class PcapReceiver : public IRawReceiver{
+public:
     // This constructor only takes one wlan (aka one wlan adapter)
     PcapReceiver(const std::string& wlan, int wlan_idx, int radio_port,PROCESS_PACKET_CALLBACK callback): WLAN_NAME(wlan),WLAN_IDX(wlan_idx),RADIO_PORT(radio_port), mCallback(callback){
         ppcap=RawReceiverHelper::openRxWithPcap(wlan, RADIO_PORT);
@@ -232,7 +307,7 @@ public:
     const std::string WLAN_NAME;
     // the wifi interface this receiver listens on (not the radio port)
     const int WLAN_IDX;
-    // the radio port it filters pacp packets for
+    // the radio port it filters pacp packets for (or RawReceiverHelper::ALL_RADIO_PORTS)
     const int RADIO_PORT;
 public:
     // this callback is called with valid data when doing loop_iter()
@@ -247,38 +322,191 @@ public:
 };
 
 
+// IRawReceiver using an AF_PACKET socket with a TPACKET_V3 rx ring that is mmap'ed into user space, with the same filter as the PcapReceiver.
+// The kernel writes the packets into blocks of the ring, a block is handed to user space once it is full or its timeout expired (retired).
+// loop_iter() passes all packets of each retired block to the callback in place (no copy), then returns the block to the kernel.
+// This means one wakeup per block instead of one per packet, but a packet might wait for up to the block timeout.
+class RxRingReceiver : public IRawReceiver{
+public:
+    struct Config{
+        // size of one block, rounded up to a multiple of the page size
+        std::size_t blockSize=128*1024;
+        // n of blocks in the ring
+        std::size_t nBlocks=16;
+        // a block that is not full yet is handed to user space after this time
+        std::chrono::milliseconds blockTimeout{1};
+    };
+    RxRingReceiver(const std::string& wlan, int wlan_idx, int radio_port,PROCESS_PACKET_CALLBACK callback,const Config& config):
+            WLAN_NAME(wlan),WLAN_IDX(wlan_idx),RADIO_PORT(radio_port), mCallback(std::move(callback)),
+            BLOCK_SIZE(roundUpToPageSize(config.blockSize)),N_BLOCKS(std::max(config.nBlocks,(std::size_t)1)){
+        fd=socket(AF_PACKET,SOCK_RAW,0);
+        if(fd<0){
+            throw std::runtime_error(StringFormat::convert("Unable to open rx socket for %s: %s", wlan.c_str(), strerror(errno)));
+        }
+        try{
+            // the filter has to be set before the socket is bound, otherwise packets of other radio ports might end up in the ring
+            RawReceiverHelper::attachBpfFilter(fd,wlan,RADIO_PORT);
+            const int version=TPACKET_V3;
+            if(setsockopt(fd,SOL_PACKET,PACKET_VERSION,&version,sizeof(version))<0){
+                throw std::runtime_error(StringFormat::convert("Unable to set TPACKET_V3 on %s: %s", wlan.c_str(), strerror(errno)));
+            }
+            tpacket_req3 req{};
+            req.tp_block_size=BLOCK_SIZE;
+            req.tp_block_nr=N_BLOCKS;
+            req.tp_frame_size=FRAME_SIZE;
+            req.tp_frame_nr=(BLOCK_SIZE/FRAME_SIZE)*N_BLOCKS;
+            req.tp_retire_blk_tov=std::max((int)config.blockTimeout.count(),1);
+            if(setsockopt(fd,SOL_PACKET,PACKET_RX_RING,&req,sizeof(req))<0){
+                throw std::runtime_error(StringFormat::convert("Unable to set up rx ring on %s: %s", wlan.c_str(), strerror(errno)));
+            }
+            void* mem=mmap(nullptr,BLOCK_SIZE*N_BLOCKS,PROT_READ|PROT_WRITE,MAP_SHARED,fd,0);
+            if(mem==MAP_FAILED){
+                throw std::runtime_error(StringFormat::convert("Unable to mmap rx ring on %s: %s", wlan.c_str(), strerror(errno)));
+            }
+            ring=(uint8_t*)mem;
+            const int ifIndex=(int)if_nametoindex(wlan.c_str());
+            if(ifIndex==0){
+                throw std::runtime_error(StringFormat::convert("Unknown interface %s", wlan.c_str()));
+            }
+            // same as pcap_set_promisc
+            packet_mreq mreq{};
+            mreq.mr_ifindex=ifIndex;
+            mreq.mr_type=PACKET_MR_PROMISC;
+            if(setsockopt(fd,SOL_PACKET,PACKET_ADD_MEMBERSHIP,&mreq,sizeof(mreq))<0){
+                throw std::runtime_error(StringFormat::convert("set_promisc failed on %s: %s", wlan.c_str(), strerror(errno)));
+            }
+            sockaddr_ll addr{};
+            addr.sll_family=AF_PACKET;
+            addr.sll_protocol=htons(ETH_P_ALL);
+            addr.sll_ifindex=ifIndex;
+            if(bind(fd,(sockaddr*)&addr,sizeof(addr))<0){
+                throw std::runtime_error(StringFormat::convert("Unable to bind rx socket to %s: %s", wlan.c_str(), strerror(errno)));
+            }
+        }catch(...){
+            if(ring!=nullptr)munmap(ring,BLOCK_SIZE*N_BLOCKS);
+            close(fd);
+            throw;
+        }
+        std::cout<<"RxRingReceiver "<<wlan<<" block size:"<<BLOCK_SIZE<<" n blocks:"<<N_BLOCKS<<" block timeout(ms):"<<std::max((int)config.blockTimeout.count(),1)<<"\n";
+    }
+    ~RxRingReceiver(){
+        munmap(ring,BLOCK_SIZE*N_BLOCKS);
+        close(fd);
+    }
+    // process all retired blocks, then return
+    int loop_iter() {
+        int nPackets=0;
+        for(;;){
+            auto* block=(tpacket_block_desc*)(ring+currBlockIdx*BLOCK_SIZE);
+            if((__atomic_load_n(&block->hdr.bh1.block_status,__ATOMIC_ACQUIRE) & TP_STATUS_USER)==0){
+                break;
+            }
+            nPackets+=(int)forEachPacketInBlock(*block,[this](const pcap_pkthdr& hdr,const uint8_t* pkt){
+                mCallback(WLAN_IDX,hdr,pkt);
+            });
+            // give the block back to the kernel
+            __atomic_store_n(&block->hdr.bh1.block_status,TP_STATUS_KERNEL,__ATOMIC_RELEASE);
+            currBlockIdx=(currBlockIdx+1)%N_BLOCKS;
+        }
+        return nPackets;
+    }
+    int getfd() const { return fd; }
+    // Calls @param f(hdr,pkt) for each packet of the retired @param block, in the order the kernel wrote them.
+    // @param pkt points to the packet (starting with the radiotap header) inside the block.
+    // @return the n of packets in the block
+    template<class F>
+    static uint32_t forEachPacketInBlock(const tpacket_block_desc& block,F&& f){
+        const auto nPacketsInBlock=block.hdr.bh1.num_pkts;
+        const uint8_t* pkt=(const uint8_t*)&block+block.hdr.bh1.offset_to_first_pkt;
+        for(uint32_t i=0;i<nPacketsInBlock;i++){
+            const auto* tpHdr=(const tpacket3_hdr*)pkt;
+            pcap_pkthdr hdr{};
+            hdr.ts.tv_sec=tpHdr->tp_sec;
+            hdr.ts.tv_usec=tpHdr->tp_nsec/1000;
+            hdr.caplen=tpHdr->tp_snaplen;
+            hdr.len=tpHdr->tp_len;
+            f(hdr,pkt+tpHdr->tp_mac);
+            pkt+=tpHdr->tp_next_offset;
+        }
+        return nPacketsInBlock;
+    }
+public:
+    // name of the wlan
+    const std::string WLAN_NAME;
+    // the wifi interface this receiver listens on (not the radio port)
+    const int WLAN_IDX;
+    // the radio port it filters packets for (or RawReceiverHelper::ALL_RADIO_PORTS)
+    const int RADIO_PORT;
+private:
+    // only used by the kernel to calculate the n of frames, with TPACKET_V3 frames are packed into the block
+    static constexpr std::size_t FRAME_SIZE=2048;
+    // Called once per packet. This stays a std::function (instead of passing the whole block to a templated consumer):
+    // MultiRxPcapReceiver selects both the receiver (pcap or rx ring) and the consumer (WBReceiver or WBStreamDemultiplexer) at runtime,
+    // and one indirect call per packet is small next to the parsing, decryption and FEC work that follows for each packet.
+    // The frame walking itself is inlined (see forEachPacketInBlock()).
+    const PROCESS_PACKET_CALLBACK mCallback;
+    const std::size_t BLOCK_SIZE;
+    const std::size_t N_BLOCKS;
+    int fd;
+    uint8_t* ring=nullptr;
+    std::size_t currBlockIdx=0;
+    static std::size_t roundUpToPageSize(const std::size_t size){
+        const auto pageSize=(std::size_t)sysconf(_SC_PAGESIZE);
+        return (std::max(size,FRAME_SIZE)+pageSize-1)/pageSize*pageSize;
+    }
+};
+
 // This class supports more than one Receiver (aka multiple wlan adapters)
 // 3 Callbacks to register:
 // 1) the PROCESS_PACKET_CALLBACK. You can find out from which wifi card this packet came by @param wlan_idx
 // 2) mCallbackLog: callback that is called in regular intervals, independent of weather data was received or not
-// 3) mCallbackFlush: callback that is called when no data has been received for n ms
+// 3) mCallbackFlush: (optional) callback that is called in regular intervals of flush_interval, independent of weather data was received or not
 class MultiRxPcapReceiver{
 public:
     typedef std::function<void()> GENERIC_CALLBACK;
     /**
      * @param rxInterfaces list of wifi adapters to listen on
-     * @param radio_port  radio port (aka stream ID) to filter packets for
+     * @param radio_port  radio port (aka stream ID) to filter packets for, RawReceiverHelper::ALL_RADIO_PORTS to receive all streams
      * @param log_interval the log callback is called in the interval specified by @param log_interval
-     * @param flush_interval the flush callback is called every time no data has been received for more than @param flush_interval milliseconds
+     * @param flush_interval the flush callback is called in the interval specified by @param flush_interval. Use 0 to disable.
+     * The poll timeout is tightened accordingly, such that the flush callback is called in time even though no data is received.
+     * @param rxRingConfig if set, the wifi adapters are read with a RxRingReceiver instead of a PcapReceiver
      */
     explicit MultiRxPcapReceiver(const std::vector<std::string> rxInterfaces1,const int radio_port,const std::chrono::milliseconds log_interval,
-                                 PcapReceiver::PROCESS_PACKET_CALLBACK dataCallback,GENERIC_CALLBACK logCallback):
-            rxInterfaces(rxInterfaces1), radio_port(radio_port), log_interval(log_interval), mCallbackData(std::move(dataCallback)), mCallbackLog(std::move(logCallback)){
+                                 PcapReceiver::PROCESS_PACKET_CALLBACK dataCallback,GENERIC_CALLBACK logCallback,
+                                 const std::chrono::milliseconds flush_interval=std::chrono::milliseconds(0),GENERIC_CALLBACK flushCallback=nullptr,
+                                 const std::optional<RxRingReceiver::Config> rxRingConfig=std::nullopt):
+            rxInterfaces(rxInterfaces1), radio_port(radio_port), log_interval(log_interval), flush_interval(flush_interval),
+            mCallbackData(std::move(dataCallback)), mCallbackLog(std::move(logCallback)), mCallbackFlush(std::move(flushCallback)){
         const int N_RECEIVERS = rxInterfaces.size();
         mReceivers.resize(N_RECEIVERS);
         mReceiverFDs.resize(N_RECEIVERS);
         memset(mReceiverFDs.data(), '\0', mReceiverFDs.size()*sizeof(pollfd));
         std::stringstream ss;
-        ss<<"MultiRxPcapReceiver"<<" Assigned ID: "<<radio_port<<" Assigned WLAN(s):[";
+        ss<<"MultiRxPcapReceiver"<<" Assigned ID: ";
+        if(radio_port==RawReceiverHelper::ALL_RADIO_PORTS){
+            ss<<"all";
+        }else{
+            ss<<radio_port;
+        }
+        ss<<" Assigned WLAN(s):[";
         for(const auto& s:rxInterfaces){
             ss<<s<<",";
         }
         ss<<"]";
-        ss<<" LOG_INTERVAL(ms)"<<(int)log_interval.count()<<"\n";
+        ss<<" LOG_INTERVAL(ms)"<<(int)log_interval.count();
+        if(isFlushEnabled()){
+            ss<<" FLUSH_INTERVAL(ms)"<<(int)flush_interval.count();
+        }
+        ss<<"\n";
         std::cout<<ss.str()<<"\n";
 
         for (int i = 0; i < N_RECEIVERS; i++) {
-            mReceivers[i] = std::make_unique<PcapReceiver>(rxInterfaces[i], i, radio_port,mCallbackData);
+            if(rxRingConfig){
+                mReceivers[i] = std::make_unique<RxRingReceiver>(rxInterfaces[i], i, radio_port,mCallbackData,*rxRingConfig);
+            }else{
+                mReceivers[i] = std::make_unique<PcapReceiver>(rxInterfaces[i], i, radio_port,mCallbackData);
+            }
             mReceiverFDs[i].fd = mReceivers[i]->getfd();
             mReceiverFDs[i].events = POLLIN;
         }
@@ -287,9 +515,16 @@ public:
     // Runs until an error occurs
     void loop(){
         std::chrono::steady_clock::time_point log_send_ts{};
+        std::chrono::steady_clock::time_point flush_ts{};
         for (;;) {
             auto cur_ts=std::chrono::steady_clock::now();
-            const int timeoutMS=std::chrono::duration_cast<std::chrono::milliseconds>(log_interval).count();
+            auto timeout=std::chrono::duration_cast<std::chrono::milliseconds>(log_interval);
+            if(isFlushEnabled()){
+                // wake up in time for the next flush, but never wait less than 1ms
+                const auto untilNextFlush=std::chrono::duration_cast<std::chrono::milliseconds>(flush_ts-cur_ts);
+                timeout=std::max(std::min(timeout,untilNextFlush),std::chrono::milliseconds(1));
+            }
+            const int timeoutMS=(int)timeout.count();
             int rc = poll(mReceiverFDs.data(), mReceiverFDs.size(),timeoutMS);
 
             if (rc < 0) {
@@ -303,6 +538,10 @@ public:
                 mCallbackLog();
                 log_send_ts = std::chrono::steady_clock::now() + log_interval;
             }
+            if(isFlushEnabled() && cur_ts >= flush_ts){
+                mCallbackFlush();
+                flush_ts = std::chrono::steady_clock::now() + flush_interval;
+            }
 
             if (rc == 0){
                 // timeout expired
@@ -321,10 +560,14 @@ public:
         }
     }
 private:
+    bool isFlushEnabled()const{
+        return flush_interval>std::chrono::milliseconds(0) && mCallbackFlush;
+    }
     const std::vector<std::string> rxInterfaces;
     const int radio_port;
     const std::chrono::milliseconds log_interval;
-    std::vector<std::unique_ptr<PcapReceiver>> mReceivers;
+    const std::chrono::milliseconds flush_interval;
+    std::vector<std::unique_ptr<IRawReceiver>> mReceivers;
     std::vector<pollfd> mReceiverFDs;
     // this callback is called with the received packets from pcap
     // NOTE 1: If you are using only wifi card as RX: I personally did not see any packet reordering with my wifi adapters, but according to svpcom this would be possible
@@ -333,6 +576,8 @@ private:
     const PcapReceiver::PROCESS_PACKET_CALLBACK mCallbackData;
     // This callback is called regularily independent weather data was received or not
     const GENERIC_CALLBACK mCallbackLog;
+    // This callback is called regularily (if enabled) independent weather data was received or not
+    const GENERIC_CALLBACK mCallbackFlush;
 public:
 };
 
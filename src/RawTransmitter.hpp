@@ -7,9 +7,12 @@
 
 #include "Ieee80211Header.hpp"
 #include "RadiotapHeader.hpp"
+#include "HelperSources/FrameQueue.hpp"
+#include "HelperSources/TimeHelper.hpp"
 
 #include <cstdlib>
 #include <endian.h>
+#include <array>
 #include <fcntl.h>
 #include <ctime>
 #include <sys/mman.h>
@@ -18,6 +21,17 @@
 #include <chrono>
 #include <optional>
 #include <poll.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <utility>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <exception>
+#include <memory>
+#include <cassert>
+#include <functional>
 
 // This is a single header-only file you can use to build your own wifibroadcast link
 // It doesn't specify if / what FEC to use and so on
@@ -48,6 +62,41 @@ public:
     const std::size_t payloadSize;
 };
 
+// Radiotap and IEEE80211 header preformatted into one contiguous buffer.
+// Only the radio port and the sequence number change between packets, and they are patched in place,
+// such that the headers don't have to be re-assembled (and allocated) for each injected packet.
+// Layout: [RadiotapHeader | Ieee80211Header]
+class RadiotapIeee80211Template{
+public:
+    static constexpr auto SIZE_BYTES=RadiotapHeader::SIZE_BYTES+Ieee80211Header::SIZE_BYTES;
+    explicit RadiotapIeee80211Template(const RadiotapHeader& radiotapHeader,const Ieee80211Header& ieee80211Header=Ieee80211Header()){
+        memcpy(data.data(),radiotapHeader.getData(),RadiotapHeader::SIZE_BYTES);
+        memcpy(data.data()+RadiotapHeader::SIZE_BYTES,ieee80211Header.getData(),Ieee80211Header::SIZE_BYTES);
+    }
+    // e.g. to inject some packets with a different MCS
+    void setRadiotapHeader(const RadiotapHeader& radiotapHeader){
+        memcpy(data.data(),radiotapHeader.getData(),RadiotapHeader::SIZE_BYTES);
+    }
+    // same as Ieee80211Header::writeParams, but in place
+    void writeParams(const uint8_t radioPort,const uint16_t seqenceNumber){
+        uint8_t* ieee80211Header=data.data()+RadiotapHeader::SIZE_BYTES;
+        ieee80211Header[Ieee80211Header::SRC_MAC_LASTBYTE] = radioPort;
+        ieee80211Header[Ieee80211Header::DST_MAC_LASTBYTE] = radioPort;
+        ieee80211Header[Ieee80211Header::FRAME_SEQ_LB] = seqenceNumber & 0xff;
+        ieee80211Header[Ieee80211Header::FRAME_SEQ_HB] = (seqenceNumber >> 8) & 0xff;
+    }
+    const uint8_t* getData()const{
+        return data.data();
+    }
+    constexpr std::size_t getSize()const{
+        return data.size();
+    }
+private:
+    std::array<uint8_t,SIZE_BYTES> data{};
+};
+// no padding, such that the template can be placed directly in front of the payload in a frame buffer
+static_assert(sizeof(RadiotapIeee80211Template) == RadiotapIeee80211Template::SIZE_BYTES, "ALWAYS TRUE");
+
 namespace RawTransmitterHelper {
     // construct a radiotap packet with the following data layout:
     // [RadiotapHeader | Ieee80211Header | customHeader (if not size 0) | payload (if not size 0)]
@@ -73,6 +122,20 @@ namespace RawTransmitterHelper {
         }
         return packet;
     }
+    // scatter-gather list for a packet with the following data layout:
+    // [headers | customHeader (if not size 0) | payload (if not size 0)]
+    // @return the n of used iovec entries
+    static int createIovec(const uint8_t* headers,const std::size_t headersSize,const AbstractWBPacket& abstractWbPacket,std::array<iovec,3>& iov){
+        int n=0;
+        iov[n++]={(void*)headers,headersSize};
+        if(abstractWbPacket.customHeaderSize>0){
+            iov[n++]={(void*)abstractWbPacket.customHeader,abstractWbPacket.customHeaderSize};
+        }
+        if(abstractWbPacket.payloadSize>0){
+            iov[n++]={(void*)abstractWbPacket.payload,abstractWbPacket.payloadSize};
+        }
+        return n;
+    }
     // throw runtime exception if injecting pcap packet goes wrong (should never happen)
     static void injectPacket(pcap_t *pcap, const std::vector<uint8_t> &packetData) {
         if (pcap_inject(pcap, packetData.data(), packetData.size()) != (int)packetData.size()) {
@@ -106,6 +169,35 @@ public:
      * @return time it took to inject the packet
      */
     virtual std::chrono::steady_clock::duration injectPacket(const RadiotapHeader& radiotapHeader, const Ieee80211Header& ieee80211Header,const AbstractWBPacket& abstractWbPacket)const=0;
+    /**
+     * Inject the packet data after prefixing it with the preformatted Radiotap and IEEE80211 header.
+     * Does not allocate.
+     * @return time it took to inject the packet
+     */
+    virtual std::chrono::steady_clock::duration injectPacket(const RadiotapIeee80211Template& headers,const AbstractWBPacket& abstractWbPacket)const=0;
+    /**
+     * Inject a packet that already starts with the Radiotap and IEEE80211 header
+     * @return time it took to inject the packet
+     */
+    virtual std::chrono::steady_clock::duration injectPacket(const uint8_t* packet,std::size_t packetSize)const=0;
+    /**
+     * Queue a packet that already starts with the Radiotap and IEEE80211 header. The data is copied.
+     * Injectors that support batching inject all queued packets (in order) on the next flush(),
+     * all others inject the packet immediately.
+     */
+    virtual void queuePacket(const uint8_t* packet,std::size_t packetSize)const{
+        queuedInjectionTime+=injectPacket(packet,packetSize);
+    }
+    /**
+     * Inject all queued packets
+     * @return time it took to inject all packets queued since the last flush()
+     */
+    virtual std::chrono::steady_clock::duration flush()const{
+        return std::exchange(queuedInjectionTime,std::chrono::steady_clock::duration(0));
+    }
+    virtual ~IRawPacketInjector()=default;
+private:
+    mutable std::chrono::steady_clock::duration queuedInjectionTime{0};
 };
 
 // Pcap Transmitter injects packets into the wifi adapter using pcap
@@ -115,16 +207,34 @@ class PcapTransmitter:public IRawPacketInjector{
 public:
     explicit PcapTransmitter(const std::string &wlan){
         ppcap=RawTransmitterHelper::openTxWithPcap(wlan);
+        packetBuffer.reserve(MAX_PACKET_SIZE);
     }
     ~PcapTransmitter(){
         pcap_close(ppcap);
     }
+    // same as the snaplen, packets are never bigger than that
+    static constexpr std::size_t MAX_PACKET_SIZE=4096;
     // inject packet by prefixing wifibroadcast packet with the IEE and Radiotap header
     // return: time it took to inject the packet.If the injection time is absurdly high, you might want to do something about it
     std::chrono::steady_clock::duration injectPacket(const RadiotapHeader& radiotapHeader, const Ieee80211Header& ieee80211Header,const AbstractWBPacket& abstractWbPacket)const{
-        const auto packet = RawTransmitterHelper::createRadiotapPacket(radiotapHeader, ieee80211Header, abstractWbPacket);
+        return injectPacket(RadiotapIeee80211Template(radiotapHeader,ieee80211Header),abstractWbPacket);
+    }
+    // pcap has no scatter-gather, the packet is assembled in a buffer that is re-used for all packets
+    std::chrono::steady_clock::duration injectPacket(const RadiotapIeee80211Template& headers,const AbstractWBPacket& abstractWbPacket)const{
+        std::array<iovec,3> iov{};
+        const int iovcnt=RawTransmitterHelper::createIovec(headers.getData(),headers.getSize(),abstractWbPacket,iov);
+        packetBuffer.clear();
+        for(int i=0;i<iovcnt;i++){
+            const auto* begin=(const uint8_t*)iov[i].iov_base;
+            packetBuffer.insert(packetBuffer.end(),begin,begin+iov[i].iov_len);
+        }
+        return injectPacket(packetBuffer.data(),packetBuffer.size());
+    }
+    std::chrono::steady_clock::duration injectPacket(const uint8_t* packet,std::size_t packetSize)const{
         const auto before=std::chrono::steady_clock::now();
-        RawTransmitterHelper::injectPacket(ppcap, packet);
+        if (pcap_inject(ppcap, packet, packetSize) != (int)packetSize) {
+            throw std::runtime_error(StringFormat::convert("Unable to inject packet %s",pcap_geterr(ppcap)));
+        }
         return std::chrono::steady_clock::now()-before;
     }
     void injectControllFrame(const RadiotapHeader& radiotapHeader,const std::vector<uint8_t>& iee80211ControllHeader){
@@ -135,15 +245,27 @@ public:
     }
 private:
     pcap_t* ppcap;
+    // keeps its capacity, such that there is no allocation per packet
+    mutable std::vector<uint8_t> packetBuffer;
 };
 
 // Doesn't use pcap but somehow directly talks to the OS via socket
 // note that you still have to prefix data with the proper RadiotapHeader in this mode (just as if you were using pcap)
-// NOTE: I didn't measure any advantage for RawSocketTransmitter compared to PcapTransmitter, so I'd recommend using PcapTransmitter only
+// NOTE: I didn't measure any advantage for RawSocketTransmitter compared to PcapTransmitter for single packets,
+// but queued packets (e.g. all fragments of a FEC block) are injected with one sendmmsg() call.
 class RawSocketTransmitter : public IRawPacketInjector{
 public:
-    explicit RawSocketTransmitter(const std::string &wlan) {
+    // same as the snaplen for pcap, packets are never bigger than that
+    static constexpr std::size_t MAX_PACKET_SIZE=4096;
+    // @param maxBatchSize the max n of packets that can be queued before a flush() is forced
+    explicit RawSocketTransmitter(const std::string &wlan,const std::size_t maxBatchSize=256):
+            MAX_BATCH_SIZE(maxBatchSize),batchBuffer(maxBatchSize*MAX_PACKET_SIZE),batchIov(maxBatchSize),batchMsgs(maxBatchSize){
         sockFd= openWifiInterfaceAsTxRawSocket(wlan);
+        for(std::size_t i=0;i<MAX_BATCH_SIZE;i++){
+            batchIov[i].iov_base=batchBuffer.data()+i*MAX_PACKET_SIZE;
+            batchMsgs[i].msg_hdr.msg_iov=&batchIov[i];
+            batchMsgs[i].msg_hdr.msg_iovlen=1;
+        }
     }
     ~RawSocketTransmitter(){
         close(sockFd);
@@ -151,12 +273,61 @@ public:
     // inject packet by prefixing wifibroadcast packet with the IEE and Radiotap header
     // return: time it took to inject the packet.If the injection time is absurdly high, you might want to do something about it
     std::chrono::steady_clock::duration injectPacket(const RadiotapHeader& radiotapHeader, const Ieee80211Header& ieee80211Header,const AbstractWBPacket& abstractWbPacket)const{
-        const auto packet = RawTransmitterHelper::createRadiotapPacket(radiotapHeader, ieee80211Header, abstractWbPacket);
+        return injectPacket(RadiotapIeee80211Template(radiotapHeader,ieee80211Header),abstractWbPacket);
+    }
+    // the headers, customHeader and payload are gathered by the kernel (no copy in user space)
+    std::chrono::steady_clock::duration injectPacket(const RadiotapIeee80211Template& headers,const AbstractWBPacket& abstractWbPacket)const{
+        // keep the packet order (the time it takes to inject the queued packets counts, too)
+        const auto flushTime=flush();
+        std::array<iovec,3> iov{};
+        const int iovcnt=RawTransmitterHelper::createIovec(headers.getData(),headers.getSize(),abstractWbPacket,iov);
+        const auto packetSize=headers.getSize()+abstractWbPacket.customHeaderSize+abstractWbPacket.payloadSize;
+        msghdr msg{};
+        msg.msg_iov=iov.data();
+        msg.msg_iovlen=iovcnt;
         const auto before=std::chrono::steady_clock::now();
-        if (write(sockFd,packet.data(),packet.size()) !=packet.size()) {
+        if (sendmsg(sockFd,&msg,0) !=(ssize_t)packetSize) {
             throw std::runtime_error(StringFormat::convert("Unable to inject packet (raw sock) %s",strerror(errno)));
         }
-        return std::chrono::steady_clock::now()-before;
+        return flushTime+(std::chrono::steady_clock::now()-before);
+    }
+    std::chrono::steady_clock::duration injectPacket(const uint8_t* packet,std::size_t packetSize)const{
+        const auto flushTime=flush();
+        const auto before=std::chrono::steady_clock::now();
+        if (write(sockFd,packet,packetSize) !=packetSize) {
+            throw std::runtime_error(StringFormat::convert("Unable to inject packet (raw sock) %s",strerror(errno)));
+        }
+        return flushTime+(std::chrono::steady_clock::now()-before);
+    }
+    void queuePacket(const uint8_t* packet,std::size_t packetSize)const{
+        if(packetSize>MAX_PACKET_SIZE){
+            throw std::runtime_error(StringFormat::convert("Packet too big for batch %d",(int)packetSize));
+        }
+        if(nBatchedPackets==MAX_BATCH_SIZE){
+            batchFullInjectionTime+=flush();
+        }
+        memcpy(batchIov[nBatchedPackets].iov_base,packet,packetSize);
+        batchIov[nBatchedPackets].iov_len=packetSize;
+        nBatchedPackets++;
+    }
+    // inject all queued packets in order, with as few sendmmsg() calls as possible
+    std::chrono::steady_clock::duration flush()const{
+        if(nBatchedPackets==0){
+            return std::exchange(batchFullInjectionTime,std::chrono::steady_clock::duration(0));
+        }
+        const auto before=std::chrono::steady_clock::now();
+        std::size_t nSent=0;
+        while(nSent<nBatchedPackets){
+            // returns the n of packets sent, which can be less than requested
+            const int ret=sendmmsg(sockFd,&batchMsgs[nSent],nBatchedPackets-nSent,0);
+            if(ret<=0){
+                nBatchedPackets=0;
+                throw std::runtime_error(StringFormat::convert("Unable to inject packet (raw sock batch) %s",strerror(errno)));
+            }
+            nSent+=ret;
+        }
+        nBatchedPackets=0;
+        return std::exchange(batchFullInjectionTime,std::chrono::steady_clock::duration(0))+(std::chrono::steady_clock::now()-before);
     }
     // taken from https://github.com/OpenHD/Open.HD/blob/2.0/wifibroadcast-base/tx_rawsock.c#L86
     // open wifi interface using a socket (somehow this works ?!)
@@ -204,6 +375,617 @@ public:
     }
 private:
     int sockFd;
+    const std::size_t MAX_BATCH_SIZE;
+    // one slot of MAX_PACKET_SIZE per queued packet, allocated once
+    std::vector<uint8_t> batchBuffer;
+    mutable std::vector<iovec> batchIov;
+    mutable std::vector<mmsghdr> batchMsgs;
+    mutable std::size_t nBatchedPackets=0;
+    // injection time of the packets sent because the batch was full
+    mutable std::chrono::steady_clock::duration batchFullInjectionTime{0};
+};
+
+// Uses a PACKET_TX_RING (TPACKET_V2) shared with the kernel: Packets are written into the ring slots
+// and one send() injects all of them (e.g. a whole FEC block), instead of one syscall per packet.
+// PACKET_QDISC_BYPASS is enabled if supported, the packets are handed directly to the driver.
+// Packets given to injectPacket() are injected immediately, use queuePacket() / flush() for batching.
+class TxRingTransmitter : public IRawPacketInjector{
+public:
+    // a slot has to fit the TPACKET_V2 header and the biggest packet
+    static constexpr std::size_t FRAME_SIZE=2048;
+    static constexpr std::size_t N_FRAMES_PER_BLOCK=8;
+    static constexpr std::size_t DATA_OFFSET=TPACKET2_HDRLEN-sizeof(sockaddr_ll);
+    static constexpr std::size_t MAX_PACKET_SIZE=FRAME_SIZE-DATA_OFFSET;
+    // @param nFrames n of ring slots, the max n of packets that can be queued before a flush() is forced
+    explicit TxRingTransmitter(const std::string &wlan,const std::size_t nFrames=256):
+            N_FRAMES((nFrames+N_FRAMES_PER_BLOCK-1)/N_FRAMES_PER_BLOCK*N_FRAMES_PER_BLOCK){
+        sockFd=RawSocketTransmitter::openWifiInterfaceAsTxRawSocket(wlan);
+        const int one=1;
+        if(setsockopt(sockFd, SOL_PACKET, PACKET_QDISC_BYPASS, &one, sizeof(one)) < 0){
+            std::cerr<<"setsockopt PACKET_QDISC_BYPASS failed (old kernel ?) "<<strerror(errno)<<"\n";
+        }
+        const int version=TPACKET_V2;
+        if(setsockopt(sockFd, SOL_PACKET, PACKET_VERSION, &version, sizeof(version)) < 0){
+            close(sockFd);
+            throw std::runtime_error(StringFormat::convert("setsockopt PACKET_VERSION failed %s",strerror(errno)));
+        }
+        tpacket_req req{};
+        req.tp_frame_size=FRAME_SIZE;
+        req.tp_frame_nr=N_FRAMES;
+        req.tp_block_size=FRAME_SIZE*N_FRAMES_PER_BLOCK;
+        req.tp_block_nr=N_FRAMES/N_FRAMES_PER_BLOCK;
+        if(setsockopt(sockFd, SOL_PACKET, PACKET_TX_RING, &req, sizeof(req)) < 0){
+            close(sockFd);
+            throw std::runtime_error(StringFormat::convert("setsockopt PACKET_TX_RING failed %s",strerror(errno)));
+        }
+        ringSize=N_FRAMES*FRAME_SIZE;
+        void* mapped=mmap(nullptr, ringSize, PROT_READ | PROT_WRITE, MAP_SHARED, sockFd, 0);
+        if(mapped==MAP_FAILED){
+            close(sockFd);
+            throw std::runtime_error(StringFormat::convert("mmap PACKET_TX_RING failed %s",strerror(errno)));
+        }
+        ring=(uint8_t*)mapped;
+    }
+    ~TxRingTransmitter(){
+        munmap(ring,ringSize);
+        close(sockFd);
+    }
+    std::chrono::steady_clock::duration injectPacket(const RadiotapHeader& radiotapHeader, const Ieee80211Header& ieee80211Header,const AbstractWBPacket& abstractWbPacket)const{
+        return injectPacket(RadiotapIeee80211Template(radiotapHeader,ieee80211Header),abstractWbPacket);
+    }
+    std::chrono::steady_clock::duration injectPacket(const RadiotapIeee80211Template& headers,const AbstractWBPacket& abstractWbPacket)const{
+        std::array<iovec,3> iov{};
+        const int iovcnt=RawTransmitterHelper::createIovec(headers.getData(),headers.getSize(),abstractWbPacket,iov);
+        queueIovec(iov.data(),iovcnt);
+        return flush();
+    }
+    std::chrono::steady_clock::duration injectPacket(const uint8_t* packet,std::size_t packetSize)const{
+        queuePacket(packet,packetSize);
+        return flush();
+    }
+    void queuePacket(const uint8_t* packet,std::size_t packetSize)const{
+        const iovec iov{(void*)packet,packetSize};
+        queueIovec(&iov,1);
+    }
+    std::chrono::steady_clock::duration flush()const{
+        if(nQueuedPackets==0){
+            return std::chrono::steady_clock::duration(0);
+        }
+        const auto before=std::chrono::steady_clock::now();
+        sendRequestedFrames();
+        return std::chrono::steady_clock::now()-before;
+    }
+    // n of slots that were rejected by the kernel (TP_STATUS_WRONG_FORMAT)
+    uint64_t getNWrongFormat()const{
+        return count_wrong_format;
+    }
+private:
+    const std::size_t N_FRAMES;
+    int sockFd;
+    uint8_t* ring=nullptr;
+    std::size_t ringSize=0;
+    // the slot the next packet is written to
+    mutable std::size_t currFrameIdx=0;
+    mutable std::size_t nQueuedPackets=0;
+    mutable uint64_t count_wrong_format=0;
+    tpacket2_hdr* getFrame(const std::size_t idx)const{
+        return (tpacket2_hdr*)(ring+idx*FRAME_SIZE);
+    }
+    static uint32_t getStatus(const tpacket2_hdr* hdr){
+        return __atomic_load_n(&hdr->tp_status,__ATOMIC_ACQUIRE);
+    }
+    // blocks until the kernel has processed all slots marked with TP_STATUS_SEND_REQUEST (or the send timeout elapsed)
+    void sendRequestedFrames()const{
+        if(send(sockFd, nullptr, 0, 0) < 0 && errno!=ETIMEDOUT && errno!=EAGAIN){
+            throw std::runtime_error(StringFormat::convert("Unable to inject packet (tx ring) %s",strerror(errno)));
+        }
+        // on a timeout, the remaining slots are still owned by the kernel and waited on before they are re-used
+        nQueuedPackets=0;
+    }
+    // wait until the kernel released the slot
+    void waitUntilAvailable(tpacket2_hdr* hdr)const{
+        for(;;){
+            const auto status=getStatus(hdr);
+            if(status==TP_STATUS_AVAILABLE)return;
+            if(status & TP_STATUS_WRONG_FORMAT){
+                count_wrong_format++;
+                __atomic_store_n(&hdr->tp_status,TP_STATUS_AVAILABLE,__ATOMIC_RELEASE);
+                return;
+            }
+            if(status==TP_STATUS_SEND_REQUEST){
+                // the ring is full, inject what we have
+                sendRequestedFrames();
+                continue;
+            }
+            // the slot is still being sent by the kernel
+            pollfd fds{sockFd,POLLOUT,0};
+            poll(&fds,1,1);
+        }
+    }
+    void queueIovec(const iovec* iov,const int iovcnt)const{
+        auto* hdr=getFrame(currFrameIdx);
+        waitUntilAvailable(hdr);
+        uint8_t* data=(uint8_t*)hdr+DATA_OFFSET;
+        std::size_t packetSize=0;
+        for(int i=0;i<iovcnt;i++){
+            if(packetSize+iov[i].iov_len>MAX_PACKET_SIZE){
+                throw std::runtime_error(StringFormat::convert("Packet too big for tx ring %d",(int)(packetSize+iov[i].iov_len)));
+            }
+            memcpy(data+packetSize,iov[i].iov_base,iov[i].iov_len);
+            packetSize+=iov[i].iov_len;
+        }
+        hdr->tp_len=packetSize;
+        // the kernel may only see the slot after the data has been written
+        __atomic_store_n(&hdr->tp_status,TP_STATUS_SEND_REQUEST,__ATOMIC_RELEASE);
+        currFrameIdx=(currFrameIdx+1)%N_FRAMES;
+        nQueuedPackets++;
+    }
+};
+
+// Injects the packets on its own thread using the given injector, such that the caller never blocks on a full driver queue.
+// Packets are copied into a FrameQueue, if it is full they are dropped (and counted).
+// On flush(), the injection thread is woken up and injects all queued packets using queuePacket() / flush() of the given injector.
+// The injection thread inherits the scheduling parameters of the thread that creates this instance.
+// Errors on the injection thread are re-thrown on the next call of the caller's thread.
+// If @param maxLatency is not 0, groups of packets (e.g. FEC blocks, see setGroup()) that have waited for longer than that
+// before any of their packets was injected are dropped as a whole, instead of building up latency.
+// Packets that are injected immediately (injectPacket()) don't belong to a group and are never dropped.
+// With more than one priority (see setPriority()), multiple streams can share one injection thread.
+class ThreadedInjector : public IRawPacketInjector{
+public:
+    typedef std::function<std::chrono::steady_clock::time_point()> CLOCK;
+    // @param nPriorities: n of queues, each with space for queueCapacity packets (see setPriority())
+    // @param clock: used for the queueing delay and to find stale groups, only replace it for testing
+    explicit ThreadedInjector(std::unique_ptr<IRawPacketInjector> injector,const std::size_t queueCapacity=256,
+                              const std::chrono::nanoseconds maxLatency=std::chrono::nanoseconds(0),const std::size_t nPriorities=1,
+                              CLOCK clock=std::chrono::steady_clock::now):
+            mInjector(std::move(injector)),MAX_LATENCY(maxLatency),mClock(std::move(clock)){
+        for(std::size_t i=0;i<std::max(nPriorities,(std::size_t)1);i++){
+            mQueues.push_back(std::make_unique<PriorityQueue>(queueCapacity));
+        }
+        mCurrQueue=mQueues[0].get();
+        mThread=std::thread(&ThreadedInjector::loop,this);
+    }
+    // all packets that are still queued are injected before the injection thread stops
+    ~ThreadedInjector(){
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            stop=true;
+        }
+        mCondition.notify_one();
+        mThread.join();
+    }
+    // All injectPacket() overloads only queue the packet, the returned duration is always 0.
+    // The injection time is measured on the injection thread instead (see getAvgInjectionTime()).
+    std::chrono::steady_clock::duration injectPacket(const RadiotapHeader& radiotapHeader, const Ieee80211Header& ieee80211Header,const AbstractWBPacket& abstractWbPacket)const{
+        return injectPacket(RadiotapIeee80211Template(radiotapHeader,ieee80211Header),abstractWbPacket);
+    }
+    std::chrono::steady_clock::duration injectPacket(const RadiotapIeee80211Template& headers,const AbstractWBPacket& abstractWbPacket)const{
+        std::array<iovec,3> iov{};
+        const int iovcnt=RawTransmitterHelper::createIovec(headers.getData(),headers.getSize(),abstractWbPacket,iov);
+        queueIovec(iov.data(),iovcnt,false);
+        return flush();
+    }
+    std::chrono::steady_clock::duration injectPacket(const uint8_t* packet,std::size_t packetSize)const{
+        const iovec iov{(void*)packet,packetSize};
+        queueIovec(&iov,1,false);
+        return flush();
+    }
+    void queuePacket(const uint8_t* packet,std::size_t packetSize)const{
+        const iovec iov{(void*)packet,packetSize};
+        queueIovec(&iov,1,true);
+    }
+    // Packets queued after this call go into the queue of @param priority (0 is the highest). The injection thread always
+    // injects the oldest packet of the highest priority queue that is not empty, and each queue has its own space,
+    // such that packets of a lower priority can neither delay nor crowd out packets of a higher priority.
+    void setPriority(const std::size_t priority){
+        assert(priority<mQueues.size());
+        mCurrQueue=mQueues[std::min(priority,mQueues.size()-1)].get();
+    }
+    // Packets queued (into the current priority) after this call belong to the group @param groupId.
+    // Packets of low priority groups are dropped once they have waited for half of maxLatency already.
+    void setGroup(const uint64_t groupId,const bool lowPriority=false){
+        mCurrQueue->currGroupId=groupId;
+        mCurrQueue->currGroupLowPriority=lowPriority;
+    }
+    // wake up the injection thread
+    std::chrono::steady_clock::duration flush()const{
+        rethrowInjectionError();
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            hasNewPackets=true;
+        }
+        mCondition.notify_one();
+        return std::chrono::steady_clock::duration(0);
+    }
+    // n of packets dropped because the queue was full
+    uint64_t getNDroppedPackets()const{
+        return count_dropped;
+    }
+    // n of packets injected by the injection thread
+    uint64_t getNInjectedPackets()const{
+        return count_injected.load(std::memory_order_relaxed);
+    }
+    // n of packets in all queues
+    std::size_t getQueueOccupancy()const{
+        std::size_t ret=0;
+        for(const auto& queue:mQueues){
+            ret+=queue->frames.size();
+        }
+        return ret;
+    }
+    // the highest occupancy of any queue since the last call to this method
+    std::size_t getMaxQueueOccupancyAndReset()const{
+        return std::exchange(maxQueueOccupancy,0);
+    }
+    // capacity of each queue
+    std::size_t getQueueCapacity()const{
+        return mQueues[0]->frames.capacity();
+    }
+    std::size_t getNPriorities()const{
+        return mQueues.size();
+    }
+    // the longest time a packet waited in the queue since the last call to this method
+    std::chrono::nanoseconds getMaxQueueingDelayAndReset()const{
+        return std::chrono::nanoseconds(maxQueueingDelayNs.exchange(0,std::memory_order_relaxed));
+    }
+    // n of groups that were dropped because they became too old
+    uint64_t getNDroppedGroups()const{
+        return count_dropped_groups.load(std::memory_order_relaxed);
+    }
+    // n of packets of the dropped groups
+    uint64_t getNDroppedStalePackets()const{
+        return count_dropped_stale.load(std::memory_order_relaxed);
+    }
+    // average time it took to inject one packet (on the injection thread)
+    std::chrono::nanoseconds getAvgInjectionTime()const{
+        const auto n=count_injected.load(std::memory_order_relaxed);
+        if(n==0)return std::chrono::nanoseconds(0);
+        return std::chrono::nanoseconds(totalInjectionTimeNs.load(std::memory_order_relaxed)/n);
+    }
+private:
+    const std::unique_ptr<IRawPacketInjector> mInjector;
+    // groups are tracked per queue, such that group ids only need to be unique within one priority
+    // one queued packet (already starting with the radiotap header)
+    struct Frame{
+        static constexpr std::size_t MAX_SIZE=2048;
+        std::size_t size=0;
+        std::chrono::steady_clock::time_point enqueueTime;
+        // see setGroup()
+        bool hasGroup=false;
+        uint64_t groupId=0;
+        bool lowPriority=false;
+        std::array<uint8_t,MAX_SIZE> data;
+    };
+    struct PriorityQueue{
+        explicit PriorityQueue(const std::size_t capacity):frames(capacity){}
+        FrameQueue<Frame> frames;
+        // only used by the caller's thread
+        std::optional<uint64_t> currGroupId=std::nullopt;
+        bool currGroupLowPriority=false;
+        // only used by the injection thread
+        std::optional<uint64_t> lastInjectedGroupId=std::nullopt;
+        std::optional<uint64_t> lastDroppedGroupId=std::nullopt;
+    };
+    // index 0 is the highest priority
+    std::vector<std::unique_ptr<PriorityQueue>> mQueues;
+    // see setPriority()
+    PriorityQueue* mCurrQueue=nullptr;
+    const std::chrono::nanoseconds MAX_LATENCY;
+    const CLOCK mClock;
+    std::thread mThread;
+    mutable std::mutex mMutex;
+    mutable std::condition_variable mCondition;
+    // protected by mMutex
+    mutable bool hasNewPackets=false;
+    bool stop=false;
+    // only used by the caller's thread
+    mutable uint64_t count_dropped=0;
+    mutable std::size_t maxQueueOccupancy=0;
+    // written by the injection thread
+    std::atomic<uint64_t> count_injected{0};
+    mutable std::atomic<int64_t> maxQueueingDelayNs{0};
+    std::atomic<uint64_t> count_dropped_groups{0};
+    std::atomic<uint64_t> count_dropped_stale{0};
+    // only used by the injection thread
+    std::atomic<uint64_t> totalInjectionTimeNs{0};
+#ifdef ENABLE_ADVANCED_DEBUGGING
+    // only used by the injection thread
+    Chronometer injectionTimePerPacket{"InjectionTime"};
+#endif
+    std::exception_ptr injectionError=nullptr;
+    std::atomic<bool> hasInjectionError{false};
+    void rethrowInjectionError()const{
+        if(hasInjectionError.load(std::memory_order_acquire)){
+            std::rethrow_exception(injectionError);
+        }
+    }
+    void queueIovec(const iovec* iov,const int iovcnt,const bool useGroup)const{
+        rethrowInjectionError();
+        PriorityQueue& queue=*mCurrQueue;
+        Frame* frame=queue.frames.beginWrite();
+        if(frame==nullptr){
+            count_dropped++;
+            return;
+        }
+        std::size_t frameSize=0;
+        for(int i=0;i<iovcnt;i++){
+            if(frameSize+iov[i].iov_len>Frame::MAX_SIZE){
+                throw std::runtime_error(StringFormat::convert("Packet too big for injection queue %d",(int)(frameSize+iov[i].iov_len)));
+            }
+            memcpy(frame->data.data()+frameSize,iov[i].iov_base,iov[i].iov_len);
+            frameSize+=iov[i].iov_len;
+        }
+        frame->size=frameSize;
+        frame->enqueueTime=mClock();
+        frame->hasGroup=useGroup && queue.currGroupId!=std::nullopt;
+        frame->groupId= frame->hasGroup ? *queue.currGroupId : 0;
+        frame->lowPriority=queue.currGroupLowPriority;
+        queue.frames.commitWrite();
+        maxQueueOccupancy=std::max(maxQueueOccupancy,queue.frames.size());
+    }
+    // a group is dropped if its first packet is too old, all packets of a dropped group are dropped.
+    // Once a packet of a group has been injected, the rest of the group is injected, too.
+    bool isStale(PriorityQueue& queue,const Frame& frame){
+        if(MAX_LATENCY.count()==0 || !frame.hasGroup)return false;
+        if(queue.lastDroppedGroupId==frame.groupId)return true;
+        if(queue.lastInjectedGroupId==frame.groupId)return false;
+        const auto budget= frame.lowPriority ? MAX_LATENCY/2 : MAX_LATENCY;
+        if(mClock()-frame.enqueueTime<=budget)return false;
+        queue.lastDroppedGroupId=frame.groupId;
+        count_dropped_groups.fetch_add(1,std::memory_order_relaxed);
+        return true;
+    }
+    // @return the highest priority queue that is not empty, nullptr if all queues are empty
+    PriorityQueue* getHighestPriorityQueue(){
+        for(auto& queue:mQueues){
+            if(queue->frames.front()!=nullptr)return queue.get();
+        }
+        return nullptr;
+    }
+    void loop(){
+        for(;;){
+            bool stopping;
+            {
+                std::unique_lock<std::mutex> lock(mMutex);
+                mCondition.wait_for(lock,std::chrono::milliseconds(100),[this]{return hasNewPackets || stop;});
+                stopping=stop;
+                hasNewPackets=false;
+            }
+            // once stopping, nothing is queued anymore. Drain the queues one last time, then return
+            try{
+                // inject everything that is queued as one batch. The queues are re-checked after each packet,
+                // such that a packet of a higher priority that is queued in the meantime is injected next.
+                std::size_t nPackets=0;
+                while(PriorityQueue* queue=getHighestPriorityQueue()){
+                    const Frame* frame=queue->frames.front();
+                    if(isStale(*queue,*frame)){
+                        count_dropped_stale.fetch_add(1,std::memory_order_relaxed);
+                        queue->frames.pop();
+                        continue;
+                    }
+                    if(frame->hasGroup){
+                        queue->lastInjectedGroupId=frame->groupId;
+                    }
+                    mInjector->queuePacket(frame->data.data(),frame->size);
+                    // includes the time the injector blocked (e.g. pacing)
+                    const auto queueingDelay=mClock()-frame->enqueueTime;
+                    const int64_t queueingDelayNs=std::chrono::duration_cast<std::chrono::nanoseconds>(queueingDelay).count();
+                    if(queueingDelayNs>maxQueueingDelayNs.load(std::memory_order_relaxed)){
+                        maxQueueingDelayNs.store(queueingDelayNs,std::memory_order_relaxed);
+                    }
+                    queue->frames.pop();
+                    nPackets++;
+                }
+                if(nPackets>0){
+                    const auto injectionTime=mInjector->flush();
+                    totalInjectionTimeNs.fetch_add(std::chrono::duration_cast<std::chrono::nanoseconds>(injectionTime).count(),std::memory_order_relaxed);
+                    count_injected.fetch_add(nPackets,std::memory_order_relaxed);
+#ifdef ENABLE_ADVANCED_DEBUGGING
+                    injectionTimePerPacket.add(injectionTime/nPackets);
+                    if(injectionTimePerPacket.getMax()>std::chrono::milliseconds(1)){
+                        std::cerr<<"Injecting packet took really long:"<<injectionTimePerPacket.getAvgReadable()<<"\n";
+                        injectionTimePerPacket.reset();
+                    }
+#endif
+                }
+            }catch(...){
+                injectionError=std::current_exception();
+                hasInjectionError.store(true,std::memory_order_release);
+                return;
+            }
+            if(stopping)return;
+        }
+    }
+};
+
+// Injects packets on multiple cards.
+// DUPLICATE: each packet is injected on all cards (spatial diversity, the rx drops the duplicates).
+// STRIPE: queued packets are distributed round-robin over the cards, to get more throughput than one card can inject
+// (e.g. cards on different channels, the rx has to listen on all of them). Packets given to injectPacket()
+// (e.g. session key packets) are injected on all cards in both modes.
+// The cards are flushed one after another, the injection time of each card is tracked separately.
+class MultiCardInjector : public IRawPacketInjector{
+public:
+    enum class Mode{DUPLICATE=0,STRIPE=1};
+    MultiCardInjector(std::vector<std::unique_ptr<IRawPacketInjector>> cards,const Mode mode):
+            mCards(std::move(cards)),mMode(mode),cardStats(mCards.size()){
+        assert(!mCards.empty());
+    }
+    std::chrono::steady_clock::duration injectPacket(const RadiotapHeader& radiotapHeader, const Ieee80211Header& ieee80211Header,const AbstractWBPacket& abstractWbPacket)const{
+        return injectPacket(RadiotapIeee80211Template(radiotapHeader,ieee80211Header),abstractWbPacket);
+    }
+    std::chrono::steady_clock::duration injectPacket(const RadiotapIeee80211Template& headers,const AbstractWBPacket& abstractWbPacket)const{
+        auto ret=flush();
+        for(std::size_t i=0;i<mCards.size();i++){
+            const auto injectionTime=mCards[i]->injectPacket(headers,abstractWbPacket);
+            cardStats[i].add(injectionTime,1);
+            ret+=injectionTime;
+        }
+        return ret;
+    }
+    std::chrono::steady_clock::duration injectPacket(const uint8_t* packet,std::size_t packetSize)const{
+        auto ret=flush();
+        for(std::size_t i=0;i<mCards.size();i++){
+            const auto injectionTime=mCards[i]->injectPacket(packet,packetSize);
+            cardStats[i].add(injectionTime,1);
+            ret+=injectionTime;
+        }
+        return ret;
+    }
+    void queuePacket(const uint8_t* packet,std::size_t packetSize)const{
+        if(mMode==Mode::DUPLICATE){
+            for(std::size_t i=0;i<mCards.size();i++){
+                mCards[i]->queuePacket(packet,packetSize);
+                cardStats[i].nQueued++;
+            }
+        }else{
+            mCards[nextCardIdx]->queuePacket(packet,packetSize);
+            cardStats[nextCardIdx].nQueued++;
+            nextCardIdx=(nextCardIdx+1)%mCards.size();
+        }
+    }
+    std::chrono::steady_clock::duration flush()const{
+        std::chrono::steady_clock::duration ret(0);
+        for(std::size_t i=0;i<mCards.size();i++){
+            if(cardStats[i].nQueued==0)continue;
+            const auto injectionTime=mCards[i]->flush();
+            cardStats[i].add(injectionTime,cardStats[i].nQueued);
+            cardStats[i].nQueued=0;
+            ret+=injectionTime;
+        }
+        return ret;
+    }
+    std::size_t getNCards()const{
+        return mCards.size();
+    }
+    // n of packets injected on the card with index @param cardIdx
+    uint64_t getNInjectedPackets(const std::size_t cardIdx)const{
+        return cardStats[cardIdx].nPackets.load(std::memory_order_relaxed);
+    }
+    // average time it took to inject one packet on the card with index @param cardIdx
+    std::chrono::nanoseconds getAvgInjectionTime(const std::size_t cardIdx)const{
+        const auto n=cardStats[cardIdx].nPackets.load(std::memory_order_relaxed);
+        if(n==0)return std::chrono::nanoseconds(0);
+        return std::chrono::nanoseconds(cardStats[cardIdx].totalInjectionTimeNs.load(std::memory_order_relaxed)/n);
+    }
+private:
+    const std::vector<std::unique_ptr<IRawPacketInjector>> mCards;
+    const Mode mMode;
+    mutable std::size_t nextCardIdx=0;
+    // the stats can be read from another thread than the one injecting
+    struct CardStats{
+        std::size_t nQueued=0;
+        std::atomic<uint64_t> nPackets{0};
+        std::atomic<int64_t> totalInjectionTimeNs{0};
+        void add(const std::chrono::steady_clock::duration injectionTime,const std::size_t n){
+            totalInjectionTimeNs.fetch_add(std::chrono::duration_cast<std::chrono::nanoseconds>(injectionTime).count(),std::memory_order_relaxed);
+            nPackets.fetch_add(n,std::memory_order_relaxed);
+        }
+    };
+    mutable std::vector<CardStats> cardStats;
+};
+
+// Token bucket in units of airtime: Refilled with @param airtimeShare (0,1] of the real time that passed,
+// each frame takes its estimated airtime (see Airtime::calculateAirtime). The bucket holds at most @param maxBurst.
+class AirtimePacer{
+public:
+    explicit AirtimePacer(const RadiotapHeader::UserSelectableParams& params,const double airtimeShare,const std::chrono::nanoseconds maxBurst=DEFAULT_MAX_BURST):
+            params(params),airtimeShare(airtimeShare),maxBurstNs(maxBurst.count()),tokensNs(maxBurst.count()){
+        assert(airtimeShare>0 && airtimeShare<=1.0);
+    }
+    static constexpr auto DEFAULT_MAX_BURST=std::chrono::milliseconds(5);
+    /**
+     * Take the airtime of a frame from the bucket. The bucket can go into debt, in which case the caller has to wait.
+     * @param ieee80211FrameSize size of the frame without the radiotap header
+     * @param frameParams the params the frame is sent with, if they differ from the ones given in the constructor
+     * @return how long to wait before the frame can be injected (0 if it can be injected right away)
+     */
+    std::chrono::nanoseconds reserve(const std::size_t ieee80211FrameSize,const std::chrono::steady_clock::time_point now=std::chrono::steady_clock::now(),
+                                     const std::optional<RadiotapHeader::UserSelectableParams>& frameParams=std::nullopt){
+        refill(now);
+        tokensNs-=Airtime::calculateAirtime(frameParams ? *frameParams : params,ieee80211FrameSize).count();
+        if(tokensNs>=0){
+            return std::chrono::nanoseconds(0);
+        }
+        return std::chrono::nanoseconds((int64_t)(-tokensNs/airtimeShare));
+    }
+private:
+    const RadiotapHeader::UserSelectableParams params;
+    const double airtimeShare;
+    const int64_t maxBurstNs;
+    int64_t tokensNs;
+    std::optional<std::chrono::steady_clock::time_point> lastRefill=std::nullopt;
+    void refill(const std::chrono::steady_clock::time_point now){
+        if(lastRefill!=std::nullopt){
+            const auto elapsedNs=std::chrono::duration_cast<std::chrono::nanoseconds>(now-*lastRefill).count();
+            tokensNs=std::min(maxBurstNs,tokensNs+(int64_t)(elapsedNs*airtimeShare));
+        }
+        lastRefill=now;
+    }
+};
+
+// Releases the packets to the given injector no faster than the AirtimePacer allows, such that bursts of packets
+// (e.g. all secondary fragments of a block) don't pile up in the driver / firmware queue in front of the following packets.
+// Blocks the calling thread while waiting, use it behind a ThreadedInjector.
+class PacedInjector : public IRawPacketInjector{
+public:
+    PacedInjector(std::unique_ptr<IRawPacketInjector> injector,const AirtimePacer& pacer):
+            mInjector(std::move(injector)),mPacer(pacer){}
+    std::chrono::steady_clock::duration injectPacket(const RadiotapHeader& radiotapHeader, const Ieee80211Header& ieee80211Header,const AbstractWBPacket& abstractWbPacket)const{
+        return injectPacket(RadiotapIeee80211Template(radiotapHeader,ieee80211Header),abstractWbPacket);
+    }
+    std::chrono::steady_clock::duration injectPacket(const RadiotapIeee80211Template& headers,const AbstractWBPacket& abstractWbPacket)const{
+        waitForAirtime(Ieee80211Header::SIZE_BYTES+abstractWbPacket.customHeaderSize+abstractWbPacket.payloadSize,
+                       RadiotapHeader::parseUserSelectableParams(headers.getData(),headers.getSize()));
+        return std::exchange(queuedInjectionTime,std::chrono::steady_clock::duration(0))+mInjector->injectPacket(headers,abstractWbPacket);
+    }
+    std::chrono::steady_clock::duration injectPacket(const uint8_t* packet,std::size_t packetSize)const{
+        waitForAirtime(packetSize-getRadiotapHeaderLength(packet,packetSize),RadiotapHeader::parseUserSelectableParams(packet,packetSize));
+        return std::exchange(queuedInjectionTime,std::chrono::steady_clock::duration(0))+mInjector->injectPacket(packet,packetSize);
+    }
+    void queuePacket(const uint8_t* packet,std::size_t packetSize)const{
+        waitForAirtime(packetSize-getRadiotapHeaderLength(packet,packetSize),RadiotapHeader::parseUserSelectableParams(packet,packetSize));
+        mInjector->queuePacket(packet,packetSize);
+    }
+    std::chrono::steady_clock::duration flush()const{
+        return std::exchange(queuedInjectionTime,std::chrono::steady_clock::duration(0))+mInjector->flush();
+    }
+    // n of packets that had to wait for the pacer
+    uint64_t getNDelayedPackets()const{
+        return count_delayed.load(std::memory_order_relaxed);
+    }
+    // the longest time a packet was held back by the pacer since the last call to this method
+    std::chrono::nanoseconds getMaxPacingDelayAndReset()const{
+        return std::chrono::nanoseconds(maxPacingDelayNs.exchange(0,std::memory_order_relaxed));
+    }
+private:
+    const std::unique_ptr<IRawPacketInjector> mInjector;
+    mutable AirtimePacer mPacer;
+    // injection time of the packets flushed before waiting on the pacer
+    mutable std::chrono::steady_clock::duration queuedInjectionTime{0};
+    mutable std::atomic<uint64_t> count_delayed{0};
+    mutable std::atomic<int64_t> maxPacingDelayNs{0};
+    static std::size_t getRadiotapHeaderLength(const uint8_t* packet,const std::size_t packetSize){
+        if(packetSize<4)return 0;
+        // little endian, see ieee80211_radiotap_header
+        const std::size_t len=packet[2] | (packet[3] << 8);
+        return std::min(len,packetSize);
+    }
+    // @param frameParams the params parsed from the radiotap header of the frame (if it was created by RadiotapHeader)
+    void waitForAirtime(const std::size_t ieee80211FrameSize,const std::optional<RadiotapHeader::UserSelectableParams>& frameParams)const{
+        const auto before=std::chrono::steady_clock::now();
+        const auto wait=mPacer.reserve(ieee80211FrameSize,before,frameParams);
+        if(wait.count()==0)return;
+        // everything in front of this packet is allowed to go out already
+        queuedInjectionTime+=mInjector->flush();
+        std::this_thread::sleep_until(before+wait);
+        const int64_t delayNs=std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now()-before).count();
+        if(delayNs>maxPacingDelayNs.load(std::memory_order_relaxed)){
+            maxPacingDelayNs.store(delayNs,std::memory_order_relaxed);
+        }
+        count_delayed.fetch_add(1,std::memory_order_relaxed);
+    }
 };
 
 #endif //WIFIBROADCAST_RAWTRANSMITTER_HPP
@@ -128,20 +128,31 @@ void benchmark_fec_decode(const Options& options){
     packetizedBenchmark.end();
 }
 
-// TODO: implement decryption benchmark
-void benchmark_crypt(const Options& options){
-    assert(options.benchmarkType==ENCRYPT || options.benchmarkType==DECRYPT);
-    Encryptor encryptor{std::nullopt};
+static std::string cryptNameSuffix(const EncryptionMode encryptionMode,const Cipher cipher){
+    if(encryptionMode==EncryptionMode::AUTHENTICATE_ONLY)return "_AUTHENTICATE_ONLY";
+    return cipher==Cipher::AES256GCM ? "_AES256GCM" : "_CHACHA20POLY1305";
+}
+
+// @param encryptIntoBuffer: use the encryptPacket() variant that writes into a caller-provided buffer instead of allocating a new one
+// @param encryptionMode: full AEAD or authentication only
+// @param cipher: the AEAD cipher, must be available
+void benchmark_crypt(const Options& options,const bool encryptIntoBuffer,const EncryptionMode encryptionMode=EncryptionMode::ENCRYPT_AND_AUTHENTICATE,
+                     const Cipher cipher=Cipher::CHACHA20_POLY1305){
+    assert(options.benchmarkType==ENCRYPT);
+    Encryptor encryptor{std::nullopt,false,encryptionMode,cipher};
     std::array<uint8_t,crypto_box_NONCEBYTES> sessionKeyNonce;
-    std::array<uint8_t,crypto_aead_chacha20poly1305_KEYBYTES + crypto_box_MACBYTES> sessionKeyData;
+    SessionKeyData sessionKeyData;
     encryptor.makeNewSessionKey(sessionKeyNonce,sessionKeyData);
 
     constexpr auto N_BUFFERS=1000;
     RandomBufferPot randomBufferPot{N_BUFFERS,1466};
     uint64_t nonce=0;
 
-    PacketizedBenchmark packetizedBenchmark(benchmarkTypeReadable(options.benchmarkType),1.0); // roughly 1:1
+    const std::string name=benchmarkTypeReadable(options.benchmarkType)+(encryptIntoBuffer ? "_INTO_BUFFER" : "_ALLOCATE")+
+            cryptNameSuffix(encryptionMode,cipher);
+    PacketizedBenchmark packetizedBenchmark(name,1.0); // roughly 1:1
     DurationBenchmark durationBenchmark("ENC",options.PACKET_SIZE);
+    std::vector<uint8_t> encryptedBuffer(1466+crypto_aead_chacha20poly1305_ABYTES);
 
     const auto testBegin=std::chrono::steady_clock::now();
     packetizedBenchmark.begin();
@@ -151,9 +162,15 @@ void benchmark_crypt(const Options& options){
             const auto buffer=randomBufferPot.getBuffer(i);
             uint8_t add=1;
             durationBenchmark.start();
-            const auto encrypted=encryptor.encryptPacket(nonce,buffer->data(),buffer->size(),add);
-            durationBenchmark.stop();
-            assert(encrypted.size()>0);
+            if(encryptIntoBuffer){
+                const auto encryptedSize=encryptor.encryptPacket(nonce,buffer->data(),buffer->size(),add,encryptedBuffer.data());
+                durationBenchmark.stop();
+                assert(encryptedSize>0);
+            }else{
+                const auto encrypted=encryptor.encryptPacket(nonce,buffer->data(),buffer->size(),add);
+                durationBenchmark.stop();
+                assert(encrypted.size()>0);
+            }
             nonce++;
             //
             packetizedBenchmark.doneWithPacket(buffer->size());
@@ -163,6 +180,48 @@ void benchmark_crypt(const Options& options){
     durationBenchmark.print();
 }
 
+// Encrypt N_BUFFERS packets once, then measure decrypting them (into a buffer, the same way the rx does)
+void benchmark_decrypt(const Options& options,const EncryptionMode encryptionMode,const Cipher cipher){
+    assert(options.benchmarkType==DECRYPT);
+    Encryptor encryptor{std::nullopt,false,encryptionMode,cipher};
+    Decryptor decryptor{std::nullopt};
+    std::array<uint8_t,crypto_box_NONCEBYTES> sessionKeyNonce;
+    SessionKeyData sessionKeyData;
+    encryptor.makeNewSessionKey(sessionKeyNonce,sessionKeyData);
+    decryptor.onNewPacketSessionKeyData(sessionKeyNonce,sessionKeyData);
+
+    constexpr auto N_BUFFERS=1000;
+    RandomBufferPot randomBufferPot{N_BUFFERS,1466};
+    std::vector<std::vector<uint8_t>> encryptedPackets;
+    for(int i=0;i<N_BUFFERS;i++){
+        const auto buffer=randomBufferPot.getBuffer(i);
+        uint8_t add=1;
+        encryptedPackets.push_back(encryptor.encryptPacket(i,buffer->data(),buffer->size(),add));
+    }
+
+    const std::string name=benchmarkTypeReadable(options.benchmarkType)+cryptNameSuffix(encryptionMode,cipher);
+    PacketizedBenchmark packetizedBenchmark(name,1.0); // roughly 1:1
+    DurationBenchmark durationBenchmark("DEC",options.PACKET_SIZE);
+    std::vector<uint8_t> decryptedBuffer(1466+crypto_aead_chacha20poly1305_ABYTES);
+
+    const auto testBegin=std::chrono::steady_clock::now();
+    packetizedBenchmark.begin();
+
+    while ((std::chrono::steady_clock::now()-testBegin)<std::chrono::seconds(options.benchmarkTimeSeconds)){
+        for(int i=0;i<N_BUFFERS;i++){
+            const auto& encrypted=encryptedPackets[i];
+            uint8_t add=1;
+            durationBenchmark.start();
+            const auto decryptedSize=decryptor.decryptPacket(i,encrypted.data(),encrypted.size(),add,decryptedBuffer.data());
+            durationBenchmark.stop();
+            assert(decryptedSize!=std::nullopt);
+            packetizedBenchmark.doneWithPacket(*decryptedSize);
+        }
+    }
+    packetizedBenchmark.end();
+    durationBenchmark.print();
+}
+
 
 void benchmark_decode(const Options& options){
     assert(options.benchmarkType==FEC_DECODE);
@@ -217,11 +276,26 @@ int main(int argc, char *const *argv) {
             std::cout<<"Unimplemented\n";
             break;
         case ENCRYPT:
-            benchmark_crypt(options);
+            // compare allocating a new buffer for each packet with encrypting into an existing buffer
+            benchmark_crypt(options,false);
+            benchmark_crypt(options,true);
+            // and full AEAD with authentication only
+            benchmark_crypt(options,true,EncryptionMode::AUTHENTICATE_ONLY);
+            // and the two ciphers
+            if(isCipherAvailable((uint8_t)Cipher::AES256GCM)){
+                benchmark_crypt(options,true,EncryptionMode::ENCRYPT_AND_AUTHENTICATE,Cipher::AES256GCM);
+            }else{
+                std::cout<<"AES256GCM is not available on this CPU\n";
+            }
             break;
         case DECRYPT:
-            //benchmark_crypt(options);
-            std::cout<<"Unimplemented\n";
+            benchmark_decrypt(options,EncryptionMode::ENCRYPT_AND_AUTHENTICATE,Cipher::CHACHA20_POLY1305);
+            benchmark_decrypt(options,EncryptionMode::AUTHENTICATE_ONLY,Cipher::CHACHA20_POLY1305);
+            if(isCipherAvailable((uint8_t)Cipher::AES256GCM)){
+                benchmark_decrypt(options,EncryptionMode::ENCRYPT_AND_AUTHENTICATE,Cipher::AES256GCM);
+            }else{
+                std::cout<<"AES256GCM is not available on this CPU\n";
+            }
             break;
     }
     return 0;
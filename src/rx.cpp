@@ -30,6 +30,8 @@
 #include <string>
 #include <chrono>
 #include <sstream>
+#include <vector>
+#include <array>
 
 
 WBReceiver::WBReceiver(const Options& options1) :
@@ -45,6 +47,12 @@ void WBReceiver::dump_stats() {
     const auto count_blocks_lost=mFECDDecoder ? mFECDDecoder->count_blocks_lost :0;
     const auto count_blocks_recovered=mFECDDecoder ? mFECDDecoder->count_blocks_recovered : 0;
     const auto count_fragments_recovered= mFECDDecoder ? mFECDDecoder->count_fragments_recovered : 0;
+    const auto rx_queue_size= mFECDDecoder ? mFECDDecoder->getRxQueueSize() : 0;
+    const auto count_rx_queue_overflow= mFECDDecoder ? mFECDDecoder->count_rx_queue_overflow : 0;
+    const auto max_reorder_distance= mFECDDecoder ? mFECDDecoder->max_reorder_distance : 0;
+    const auto count_secondary_decrypt_skipped= mFECDDecoder ? mFECDDecoder->count_secondary_decrypt_skipped : 0;
+    const auto count_secondary_decrypt_failed= mFECDDecoder ? mFECDDecoder->count_secondary_decrypt_failed : 0;
+    const auto count_duplicates_dropped_before_decryption= mFECDDecoder ? mFECDDecoder->count_duplicates_dropped_before_decryption : 0;
     // first forward to OpenHD
     openHdStatisticsWriter.writeStats({
         options.radio_port,count_p_all, count_p_decryption_err, count_p_decryption_ok, count_fragments_recovered, count_blocks_lost, count_p_bad, rssiForWifiCard
@@ -60,8 +68,18 @@ void WBReceiver::dump_stats() {
     std::stringstream ss;
 
     ss << runTime << "\tPKT" << count_p_all << "\tRport " << +options.radio_port << " Decryption(OK:" << count_p_decryption_ok << " Err:" << count_p_decryption_err <<
-       ") FEC(totalB:" << count_blocks_total << " lostB:" << count_blocks_lost << " recB:" << count_blocks_recovered << " recP:" << count_fragments_recovered << ")";
+       ") FEC(totalB:" << count_blocks_total << " lostB:" << count_blocks_lost << " recB:" << count_blocks_recovered << " recP:" << count_fragments_recovered <<
+       ") RxQueue(size:" << rx_queue_size << " overflow:" << count_rx_queue_overflow << " maxReorder:" << max_reorder_distance <<
+       ") LazyDecrypt(skipped:" << count_secondary_decrypt_skipped << " failed:" << count_secondary_decrypt_failed << ") DupBeforeDecrypt:" << count_duplicates_dropped_before_decryption;
 
+    if(mFECDisabledDecoder){
+        ss << " Reorder(maxDepth:" << mFECDisabledDecoder->max_reorder_depth << " late:" << mFECDisabledDecoder->count_reorder_late << ")";
+        ss << " Dup(outOfWindow:" << mFECDisabledDecoder->count_out_of_window << " perCard:";
+        for(const auto count:mFECDisabledDecoder->count_duplicates_per_rx_card){
+            ss << " " << count;
+        }
+        ss << ")";
+    }
     std::cout<<ss.str()<<"\n";
     // it is actually much more understandable when I use the absolute values for the logging
 #ifdef ENABLE_ADVANCED_DEBUGGING
@@ -72,6 +90,15 @@ void WBReceiver::dump_stats() {
 #endif
 }
 
+void WBReceiver::flushExpiredData() {
+    if(mFECDDecoder && options.fec_max_block_age>std::chrono::milliseconds(0)){
+        mFECDDecoder->removeBlocksOlderThan(options.fec_max_block_age);
+    }
+    if(mFECDisabledDecoder){
+        mFECDisabledDecoder->releaseExpiredPackets();
+    }
+}
+
 void WBReceiver::processPacket(const uint8_t WLAN_IDX, const pcap_pkthdr& hdr, const uint8_t* pkt){
 #ifdef ENABLE_ADVANCED_DEBUGGING
     const auto tmp=GenericHelper::timevalToTimePointSystemClock(hdr.ts);
@@ -145,7 +172,8 @@ void WBReceiver::processPacket(const uint8_t WLAN_IDX, const pcap_pkthdr& hdr, c
         }
         WBSessionKeyPacket &sessionKeyPacket = *((WBSessionKeyPacket *) parsedPacket->payload);
         if (mDecryptor.onNewPacketSessionKeyData(sessionKeyPacket.sessionKeyNonce, sessionKeyPacket.sessionKeyData)) {
-            std::cout<<"Initializing new session. IS_FEC_ENABLED:"<<(int)sessionKeyPacket.IS_FEC_ENABLED<<" MAX_N_FRAGMENTS_PER_BLOCK:"<<(int)sessionKeyPacket.MAX_N_FRAGMENTS_PER_BLOCK<<"\n";
+            std::cout<<"Initializing new session. IS_FEC_ENABLED:"<<(int)sessionKeyPacket.IS_FEC_ENABLED<<" MAX_N_FRAGMENTS_PER_BLOCK:"<<(int)sessionKeyPacket.MAX_N_FRAGMENTS_PER_BLOCK<<
+                " ENCRYPTION_MODE:"<<(int)mDecryptor.getEncryptionMode()<<" CIPHER:"<<(int)mDecryptor.getCipher()<<"\n";
             // We got a new session key (aka a session key that has not been received yet)
             count_p_decryption_ok++;
             IS_FEC_ENABLED=sessionKeyPacket.IS_FEC_ENABLED;
@@ -154,15 +182,25 @@ void WBReceiver::processPacket(const uint8_t WLAN_IDX, const pcap_pkthdr& hdr, c
                 //this->forwardPacketViaUDP(payload,payloadSize);
             };
             if(IS_FEC_ENABLED){
-                mFECDDecoder=std::make_unique<FECDecoder>((unsigned int)sessionKeyPacket.MAX_N_FRAGMENTS_PER_BLOCK);
+                mFECDDecoder=std::make_unique<FECDecoder>((unsigned int)sessionKeyPacket.MAX_N_FRAGMENTS_PER_BLOCK,options.fec_early_give_up,options.fec_unordered,options.fec_adaptive_rx_queue);
                 //mFECDDecoder->mSendDecodedPayloadCallback=notstd::bind_front(&WBReceiver::forwardPacketViaUDP,this);
                 //mFECDDecoder->mSendDecodedPayloadCallback=notstd::bind_front(&SocketHelper::UDPForwarder::forwardPacketViaUDP, mUDPForwarder);
                 mFECDDecoder->mSendDecodedPayloadCallback=callback;
+                mFECDDecoder->mDecryptFragmentCallback=[this](const uint64_t nonce,uint8_t* data,const std::size_t dataLen){
+                    const auto decryptedSize=mDecryptor.decryptPacket(nonce,data,dataLen,WBDataHeader(nonce),data);
+                    if(decryptedSize==std::nullopt){
+                        std::cerr << "unable to decrypt secondary fragment :" <<std::to_string(nonce)<<"\n";
+                        count_p_decryption_err ++;
+                    }else{
+                        count_p_decryption_ok++;
+                    }
+                    return decryptedSize;
+                };
             }else{
-                mFECDisabledDecoder=std::make_unique<FECDisabledDecoder>();
+                mFECDisabledDecoder=std::make_unique<FECDisabledDecoder>(options.fec_disabled_window,options.fec_disabled_reorder_delay);
                 //mFECDisabledDecoder->mSendDecodedPayloadCallback=notstd::bind_front(&WBReceiver::forwardPacketViaUDP,this);
                 //mFECDisabledDecoder->mSendDecodedPayloadCallback=notstd::bind_front(&SocketHelper::UDPForwarder::forwardPacketViaUDP, mUDPForwarder);
-                mFECDDecoder->mSendDecodedPayloadCallback=callback;
+                mFECDisabledDecoder->mSendDecodedPayloadCallback=callback;
             }
         } else {
             count_p_decryption_ok++;
@@ -177,23 +215,44 @@ void WBReceiver::processPacket(const uint8_t WLAN_IDX, const pcap_pkthdr& hdr, c
         const WBDataHeader& wbDataHeader=*((WBDataHeader*)packetPayload);
         assert(wbDataHeader.packet_type==WFB_PACKET_DATA);
 
-        const auto decryptedPayload=mDecryptor.decryptPacket(wbDataHeader.nonce,packetPayload + sizeof(WBDataHeader),
-                                                             packetPayloadSize - sizeof(WBDataHeader), wbDataHeader);
-        if(decryptedPayload == std::nullopt){
+        // with multiple rx cards, most packets are received more than once. Drop the copies before spending any time on the decryption
+        if(IS_FEC_ENABLED){
+            if(mFECDDecoder && mFECDDecoder->dropAuthenticatedDuplicate(wbDataHeader.nonce,WLAN_IDX)){
+                return;
+            }
+        }else{
+            if(mFECDisabledDecoder && mFECDisabledDecoder->dropAuthenticatedDuplicate(wbDataHeader.nonce,WLAN_IDX)){
+                return;
+            }
+        }
+
+        // secondary fragments are only decrypted if they are needed for the FEC step (or if the FECDecoder cannot decide yet)
+        if(IS_FEC_ENABLED && mFECDDecoder && options.fec_lazy_decrypt && fecNonceFrom(wbDataHeader.nonce).flag==1){
+            if(mFECDDecoder->processEncryptedSecondaryFragment(wbDataHeader.nonce,packetPayload + sizeof(WBDataHeader),packetPayloadSize - sizeof(WBDataHeader))){
+                return;
+            }
+        }
+
+        // decrypt into a buffer that is re-used for each packet (resizing within its capacity doesn't allocate)
+        mDecryptedPayload.resize(packetPayloadSize - sizeof(WBDataHeader));
+        const auto decryptedPayloadSize=mDecryptor.decryptPacket(wbDataHeader.nonce,packetPayload + sizeof(WBDataHeader),
+                                                             packetPayloadSize - sizeof(WBDataHeader), wbDataHeader,mDecryptedPayload.data());
+        if(decryptedPayloadSize == std::nullopt){
             std::cerr << "unable to decrypt packet :" <<std::to_string(wbDataHeader.nonce)<<"\n";
             count_p_decryption_err ++;
             return;
         }
 
         count_p_decryption_ok++;
+        mDecryptedPayload.resize(*decryptedPayloadSize);
 
-        assert(decryptedPayload->size() <= FEC_MAX_PACKET_SIZE);
+        assert(mDecryptedPayload.size() <= FEC_MAX_PACKET_SIZE);
         if(IS_FEC_ENABLED){
             if(!mFECDDecoder){
                 std::cout<<"FEC K,N is not set yet\n";
                 return;
             }
-            if(!mFECDDecoder->validateAndProcessPacket(wbDataHeader.nonce, *decryptedPayload)){
+            if(!mFECDDecoder->validateAndProcessPacket(wbDataHeader.nonce, mDecryptedPayload,WLAN_IDX)){
                 count_p_bad++;
             }
         }else{
@@ -201,7 +260,7 @@ void WBReceiver::processPacket(const uint8_t WLAN_IDX, const pcap_pkthdr& hdr, c
                 std::cout<<"FEC K,N is not set yet(disabled)\n";
                 return;
             }
-            mFECDisabledDecoder->processRawDataBlockFecDisabled(wbDataHeader.nonce,*decryptedPayload);
+            mFECDisabledDecoder->processRawDataBlockFecDisabled(wbDataHeader.nonce,mDecryptedPayload,WLAN_IDX);
         }
     }
 #ifdef ENABLE_ADVANCED_DEBUGGING
@@ -222,12 +281,161 @@ void WBReceiver::processPacket(const uint8_t WLAN_IDX, const pcap_pkthdr& hdr, c
     }
 }
 
+WBReceiverWorker::WBReceiverWorker(const Options& options,const std::chrono::milliseconds log_interval,const std::chrono::milliseconds flush_interval,const std::size_t queueCapacity):
+        mReceiver(options),log_interval(log_interval),flush_interval(flush_interval),mQueue(queueCapacity){
+    mThread=std::thread(&WBReceiverWorker::loop,this);
+}
+
+WBReceiverWorker::~WBReceiverWorker() {
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        stop=true;
+    }
+    mCondition.notify_one();
+    mThread.join();
+}
+
+void WBReceiverWorker::queuePacket(const uint8_t wlan_idx,const pcap_pkthdr& hdr,const uint8_t* pkt) {
+    Packet* packet=mQueue.beginWrite();
+    if(packet==nullptr || hdr.caplen>Packet::MAX_SIZE){
+        count_dropped++;
+        return;
+    }
+    packet->wlan_idx=wlan_idx;
+    packet->hdr=hdr;
+    memcpy(packet->data.data(),pkt,hdr.caplen);
+    mQueue.commitWrite();
+    // Pairs with the fence in loop(): either the worker thread sees this packet before it waits, or we see that it waits
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if(!isWaiting.load(std::memory_order_relaxed)){
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        hasNewPackets=true;
+    }
+    mCondition.notify_one();
+}
+
+void WBReceiverWorker::loop() {
+    const bool isFlushEnabled=flush_interval>std::chrono::milliseconds(0);
+    std::chrono::steady_clock::time_point log_ts=std::chrono::steady_clock::now()+log_interval;
+    std::chrono::steady_clock::time_point flush_ts{};
+    for(;;){
+        auto timeout=log_interval;
+        if(isFlushEnabled){
+            // wake up in time for the next flush, but never wait less than 1ms
+            const auto untilNextFlush=std::chrono::duration_cast<std::chrono::milliseconds>(flush_ts-std::chrono::steady_clock::now());
+            timeout=std::max(std::min(timeout,untilNextFlush),std::chrono::milliseconds(1));
+        }
+        {
+            std::unique_lock<std::mutex> lock(mMutex);
+            isWaiting.store(true,std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            // packets queued while the last ones were processed don't notify
+            if(mQueue.front()==nullptr){
+                mCondition.wait_for(lock,timeout,[this]{return hasNewPackets || stop;});
+            }
+            isWaiting.store(false,std::memory_order_relaxed);
+            if(stop)return;
+            hasNewPackets=false;
+        }
+        while(const Packet* packet=mQueue.front()){
+            mReceiver.processPacket(packet->wlan_idx,packet->hdr,packet->data.data());
+            mQueue.pop();
+        }
+        const auto cur_ts=std::chrono::steady_clock::now();
+        if(isFlushEnabled && cur_ts>=flush_ts){
+            mReceiver.flushExpiredData();
+            flush_ts=cur_ts+flush_interval;
+        }
+        if(cur_ts>=log_ts){
+            mReceiver.dump_stats();
+            log_ts=cur_ts+log_interval;
+        }
+    }
+}
+
+WBStreamDemultiplexer::WBStreamDemultiplexer(const std::vector<Options>& streams,const bool useWorkerThreads,const std::chrono::milliseconds log_interval,const std::chrono::milliseconds flush_interval){
+    mStreamIdxForRadioPort.fill(-1);
+    for(std::size_t i=0;i<streams.size();i++){
+        const auto radioPort=streams[i].radio_port;
+        if(mStreamIdxForRadioPort[radioPort]!=-1){
+            throw std::runtime_error(StringFormat::convert("Radio port %d is used by more than one stream",(int)radioPort));
+        }
+        mStreamIdxForRadioPort[radioPort]=(int)i;
+        if(useWorkerThreads){
+            mWorkers.push_back(std::make_unique<WBReceiverWorker>(streams[i],log_interval,flush_interval));
+        }else{
+            mReceivers.push_back(std::make_unique<WBReceiver>(streams[i]));
+        }
+    }
+}
+
+void WBStreamDemultiplexer::processPacket(const uint8_t wlan_idx,const pcap_pkthdr& hdr,const uint8_t* pkt) {
+    const auto radioPort=RawReceiverHelper::peekRadioPort(hdr,pkt);
+    if(radioPort==std::nullopt){
+        count_p_bad++;
+        return;
+    }
+    const int streamIdx=mStreamIdxForRadioPort[*radioPort];
+    if(streamIdx<0){
+        count_p_unknown_radio_port++;
+        return;
+    }
+    if(mWorkers.empty()){
+        mReceivers[streamIdx]->processPacket(wlan_idx,hdr,pkt);
+    }else{
+        mWorkers[streamIdx]->queuePacket(wlan_idx,hdr,pkt);
+    }
+}
+
+void WBStreamDemultiplexer::dump_stats() {
+    for(auto& receiver:mReceivers){
+        receiver->dump_stats();
+    }
+    std::stringstream ss;
+    ss << "Demux(unknownRadioPort:" << count_p_unknown_radio_port << " bad:" << count_p_bad << ")";
+    if(!mWorkers.empty()){
+        ss << " Workers(dropped:";
+        for(const auto& worker:mWorkers){
+            ss << " " << worker->getNDroppedPackets();
+        }
+        ss << ")";
+    }
+    std::cout<<ss.str()<<"\n";
+}
+
+void WBStreamDemultiplexer::flushExpiredData() {
+    for(auto& receiver:mReceivers){
+        receiver->flushExpiredData();
+    }
+}
+
+// @param stream: udp_port:radio_port, everything else is the same as in @param options
+static Options parseStream(const std::string& stream,const Options& options){
+    Options ret=options;
+    const auto colon=stream.find(':');
+    if(colon==std::string::npos){
+        throw std::runtime_error(StringFormat::convert("Invalid stream %s, expected udp_port:radio_port",stream.c_str()));
+    }
+    ret.client_udp_port=std::stoi(stream.substr(0,colon));
+    ret.radio_port=std::stoi(stream.substr(colon+1));
+    return ret;
+}
+
 int main(int argc, char *const *argv) {
     int opt;
     Options options{};
     std::chrono::milliseconds log_interval{1000};
+    // udp_port:radio_port, if empty there is only one stream (-u -r)
+    std::vector<std::string> streams;
+    bool useWorkerThreads=false;
+    // read the wifi cards with a TPACKET_V3 rx ring instead of pcap
+    bool useRxRing=false;
+    RxRingReceiver::Config rxRingConfig{};
 
-    while ((opt = getopt(argc, argv, "K:c:u:r:l:n:k:")) != -1) {
+    while ((opt = getopt(argc, argv, "K:c:u:r:l:a:e:o:q:w:d:z:x:t:R:s:b:n:k:")) != -1) {
         switch (opt) {
             case 'K':
                 options.keypair = optarg;
@@ -244,6 +452,42 @@ int main(int argc, char *const *argv) {
             case 'l':
                 log_interval = std::chrono::milliseconds(std::stoi(optarg));
                 break;
+            case 'a':
+                options.fec_max_block_age = std::chrono::milliseconds(std::stoi(optarg));
+                break;
+            case 'e':
+                options.fec_early_give_up = std::stoi(optarg)!=0;
+                break;
+            case 'o':
+                options.fec_unordered = std::stoi(optarg)!=0;
+                break;
+            case 'q':
+                options.fec_adaptive_rx_queue = std::stoi(optarg)!=0;
+                break;
+            case 'w':
+                options.fec_disabled_window = std::max(std::stoi(optarg),1);
+                break;
+            case 'd':
+                options.fec_disabled_reorder_delay = std::chrono::milliseconds(std::stoi(optarg));
+                break;
+            case 'z':
+                options.fec_lazy_decrypt = std::stoi(optarg)!=0;
+                break;
+            case 'x':
+                streams.emplace_back(optarg);
+                break;
+            case 't':
+                useWorkerThreads = std::stoi(optarg)!=0;
+                break;
+            case 'R':
+                useRxRing = std::stoi(optarg)!=0;
+                break;
+            case 's':
+                rxRingConfig.blockSize = std::max(std::stoi(optarg),1)*1024;
+                break;
+            case 'b':
+                rxRingConfig.blockTimeout = std::chrono::milliseconds(std::max(std::stoi(optarg),1));
+                break;
             case 'k':
             case 'n':
                 std::cout<<"-n is deprecated. Please read https://github.com/Consti10/wifibroadcast/blob/master/README.md \n";
@@ -251,11 +495,11 @@ int main(int argc, char *const *argv) {
             default: /* '?' */
             show_usage:
                 fprintf(stderr,
-                        "Local receiver: %s [-K rx_key] [-c client_addr] [-u udp_client_port] [-r radio_port] [-l log_interval(ms)] interface1 [interface2] ...\n",
+                        "Local receiver: %s [-K rx_key] [-c client_addr] [-u udp_client_port] [-r radio_port] [-l log_interval(ms)] [-a fec_max_block_age(ms)] [-e fec_early_give_up(0/1)] [-o fec_unordered(0/1)] [-q fec_adaptive_rx_queue(0/1)] [-w fec_disabled_duplicate_window] [-d fec_disabled_max_reorder_delay(ms)] [-z fec_lazy_decrypt(0/1)] [-x udp_client_port:radio_port (repeatable, one stream each)] [-t worker_thread_per_stream(0/1)] [-R receiver(0=pcap,1=rx ring)] [-s rx_ring_block_size(KB)] [-b rx_ring_block_timeout(ms)] interface1 [interface2] ...\n",
                         argv[0]);
-                fprintf(stderr, "Default: K='%s', connect=%s:%d, radio_port=%d, log_interval=%d \n",
+                fprintf(stderr, "Default: K='%s', connect=%s:%d, radio_port=%d, log_interval=%d fec_max_block_age=%d (disabled) fec_early_give_up=%d fec_unordered=%d fec_adaptive_rx_queue=%d fec_disabled_duplicate_window=%d fec_disabled_max_reorder_delay=%d (disabled) fec_lazy_decrypt=%d worker_thread_per_stream=%d receiver=%d rx_ring_block_size=%d rx_ring_block_timeout=%d \n",
                         "none",options.client_addr.c_str(), options.client_udp_port, options.radio_port,
-                        (int)std::chrono::duration_cast<std::chrono::milliseconds>(log_interval).count());
+                        (int)std::chrono::duration_cast<std::chrono::milliseconds>(log_interval).count(),(int)options.fec_max_block_age.count(),(int)options.fec_early_give_up,(int)options.fec_unordered,(int)options.fec_adaptive_rx_queue,(int)options.fec_disabled_window,(int)options.fec_disabled_reorder_delay.count(),(int)options.fec_lazy_decrypt,(int)useWorkerThreads,(int)useRxRing,(int)(rxRingConfig.blockSize/1024),(int)rxRingConfig.blockTimeout.count());
                 fprintf(stderr, "WFB version "
                 WFB_VERSION
                 "\n");
@@ -276,12 +520,40 @@ int main(int argc, char *const *argv) {
         rxInterfaces.emplace_back(argv[optind + i]);
     }
     try {
-        std::shared_ptr<WBReceiver> agg=std::make_shared<WBReceiver>(options);
-        MultiRxPcapReceiver receiver(rxInterfaces,options.radio_port,log_interval,
-                                     notstd::bind_front(&WBReceiver::processPacket, agg.get()),
-                                     notstd::bind_front(&WBReceiver::dump_stats, agg.get()));
-        receiver.loop();
-    } catch (std::runtime_error &e) {
+        // check for expired blocks twice per max block age, this bounds the latency to 1.5x fec_max_block_age
+        // flush often enough for both the FEC max block age and the FEC disabled re-order delay (0 if neither is enabled)
+        std::chrono::milliseconds flush_interval{0};
+        for(const auto deadline:{options.fec_max_block_age,options.fec_disabled_reorder_delay}){
+            if(deadline.count()>0){
+                const auto interval=std::max(deadline/2,std::chrono::milliseconds(1));
+                flush_interval=flush_interval.count()>0 ? std::min(flush_interval,interval) : interval;
+            }
+        }
+        if(streams.empty()){
+            std::shared_ptr<WBReceiver> agg=std::make_shared<WBReceiver>(options);
+            MultiRxPcapReceiver receiver(rxInterfaces,options.radio_port,log_interval,
+                                         notstd::bind_front(&WBReceiver::processPacket, agg.get()),
+                                         notstd::bind_front(&WBReceiver::dump_stats, agg.get()),
+                                         flush_interval,
+                                         notstd::bind_front(&WBReceiver::flushExpiredData, agg.get()),
+                                         useRxRing ? std::make_optional(rxRingConfig) : std::nullopt);
+            receiver.loop();
+        }else{
+            // one capture per card for all streams, the packets are demultiplexed by their radio port
+            std::vector<Options> streamOptions;
+            for(const auto& stream:streams){
+                streamOptions.push_back(parseStream(stream,options));
+            }
+            WBStreamDemultiplexer demultiplexer(streamOptions,useWorkerThreads,log_interval,flush_interval);
+            MultiRxPcapReceiver receiver(rxInterfaces,RawReceiverHelper::ALL_RADIO_PORTS,log_interval,
+                                         notstd::bind_front(&WBStreamDemultiplexer::processPacket, &demultiplexer),
+                                         notstd::bind_front(&WBStreamDemultiplexer::dump_stats, &demultiplexer),
+                                         useWorkerThreads ? std::chrono::milliseconds(0) : flush_interval,
+                                         notstd::bind_front(&WBStreamDemultiplexer::flushExpiredData, &demultiplexer),
+                                         useRxRing ? std::make_optional(rxRingConfig) : std::nullopt);
+            receiver.loop();
+        }
+    } catch (std::exception &e) {
         fprintf(stderr, "Error: %s\n", e.what());
         exit(1);
     }
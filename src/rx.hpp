@@ -22,6 +22,7 @@
 #include "HelperSources/Helper.hpp"
 #include "OpenHDStatisticsWriter.hpp"
 #include "HelperSources/TimeHelper.hpp"
+#include "HelperSources/FrameQueue.hpp"
 
 #include <unordered_map>
 #include <cstdint>
@@ -34,6 +35,13 @@
 #include <cstring>
 #include <stdexcept>
 #include <utility>
+#include <array>
+#include <atomic>
+#include <vector>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
 
 // A wifi card with more than 4 antennas still has to be found :)
 static constexpr const auto MAX_N_ANTENNAS_PER_WIFI_CARD=4;
@@ -45,7 +53,25 @@ struct Options{
     std::string client_addr="127.0.0.1";// default to localhost
     //std::string keypair="gs.key"; //default filename
     std::optional<std::string> keypair=std::nullopt;
+    // max time the rx waits for a FEC block to be completed (or recovered) before giving up on it and forwarding what is available.
+    // 0 means disabled (a block is only given up when the rx queue overflows or a later block is completed)
+    std::chrono::milliseconds fec_max_block_age{0};
+    // give up on a FEC block as soon as it cannot be recovered anymore. Assumes that a rx card does not re-order packets,
+    // therefore off by default (opt in with -e 1)
+    bool fec_early_give_up=false;
+    // forward packets as soon as they are received instead of in order. Only for consumers that can deal with re-ordered packets
+    bool fec_unordered=false;
+    // adapt the size of the FEC rx queue to the measured re-ordering between the rx cards, instead of using a fixed size.
+    // Off by default (opt in with -q 1)
+    bool fec_adaptive_rx_queue=false;
+    // n of most recent sequence numbers checked for duplicates if FEC is disabled
+    std::size_t fec_disabled_window=FECDisabledDecoder::DEFAULT_WINDOW_SIZE;
+    // if FEC is disabled, forward packets in order but hold each packet back for at most this long. 0 means disabled (forward in arrival order)
+    std::chrono::milliseconds fec_disabled_reorder_delay{0};
+    // only authenticate and decrypt FEC secondary fragments if they are actually needed to recover a block
+    bool fec_lazy_decrypt=true;
 };
+static_assert(crypto_aead_chacha20poly1305_ABYTES<=MAX_ENCRYPTION_OVERHEAD,"Encrypted secondary fragments have to fit into the RxBlock");
 
 // This class processes the received wifi data (decryption and FEC)
 // and forwards it via UDP.
@@ -56,10 +82,15 @@ public:
     void processPacket(uint8_t wlan_idx,const pcap_pkthdr& hdr,const uint8_t* pkt);
     // dump statistics
     void dump_stats();
-    const Options& options;
+    // give up on FEC blocks that are older than the max block age from the options,
+    // and release FEC disabled packets that have been waiting for longer than the max re-order delay
+    void flushExpiredData();
+    const Options options;
 private:
     const std::chrono::steady_clock::time_point INIT_TIME=std::chrono::steady_clock::now();
     Decryptor mDecryptor;
+    // decrypted data of the current packet, re-used to avoid an allocation per packet
+    std::vector<uint8_t> mDecryptedPayload;
     // this one is used to forward packets
     SocketHelper::UDPForwarder mUDPForwarder;
     std::array<RSSIForWifiCard,MAX_RX_INTERFACES> rssiForWifiCard;
@@ -85,3 +116,64 @@ public:
 #endif
 };
 
+// Processes the packets of one stream (WBReceiver) on its own thread. The packets (including their pcap header) are copied into a FrameQueue,
+// if it is full they are dropped (and counted). The flush and log callbacks of the WBReceiver are called on the worker thread, too.
+class WBReceiverWorker{
+public:
+    WBReceiverWorker(const Options& options,std::chrono::milliseconds log_interval,std::chrono::milliseconds flush_interval,std::size_t queueCapacity=1024);
+    ~WBReceiverWorker();
+    // copy the packet into the queue and wake up the worker thread (if it is waiting)
+    void queuePacket(uint8_t wlan_idx,const pcap_pkthdr& hdr,const uint8_t* pkt);
+    // n of packets dropped because the queue was full or they were too big
+    uint64_t getNDroppedPackets()const{
+        return count_dropped;
+    }
+private:
+    WBReceiver mReceiver;
+    const std::chrono::milliseconds log_interval;
+    const std::chrono::milliseconds flush_interval;
+    // one received packet, including its pcap header
+    struct Packet{
+        static constexpr std::size_t MAX_SIZE=2048;
+        uint8_t wlan_idx=0;
+        pcap_pkthdr hdr{};
+        std::array<uint8_t,MAX_SIZE> data;
+    };
+    FrameQueue<Packet> mQueue;
+    std::thread mThread;
+    std::mutex mMutex;
+    std::condition_variable mCondition;
+    // protected by mMutex
+    bool hasNewPackets=false;
+    bool stop=false;
+    // set by the worker thread while it is (about to be) waiting for new packets, such that the caller's thread
+    // only has to lock the mutex and notify if the worker thread actually waits
+    std::atomic<bool> isWaiting{false};
+    // only used by the caller's thread
+    uint64_t count_dropped=0;
+    void loop();
+};
+
+// Demultiplexes the packets of all radio ports (received without a radio port filter) into one WBReceiver per stream,
+// such that one capture per card is enough for all streams. Optionally, each stream is processed on its own thread (WBReceiverWorker).
+class WBStreamDemultiplexer{
+public:
+    // @param streams: one per stream, each with a unique radio port
+    // @param log_interval, flush_interval: only used with worker threads, see MultiRxPcapReceiver otherwise
+    WBStreamDemultiplexer(const std::vector<Options>& streams,bool useWorkerThreads,std::chrono::milliseconds log_interval,std::chrono::milliseconds flush_interval);
+    void processPacket(uint8_t wlan_idx,const pcap_pkthdr& hdr,const uint8_t* pkt);
+    // dump statistics (each worker thread dumps the statistics of its stream itself)
+    void dump_stats();
+    // no-op with worker threads, they flush their stream themselves
+    void flushExpiredData();
+private:
+    // only one of those two is used
+    std::vector<std::unique_ptr<WBReceiver>> mReceivers;
+    std::vector<std::unique_ptr<WBReceiverWorker>> mWorkers;
+    // indexed by radio port, -1 if there is no stream for this radio port
+    std::array<int,256> mStreamIdxForRadioPort{};
+    // n of packets of radio ports no stream is assigned to
+    uint64_t count_p_unknown_radio_port=0;
+    // n of packets too short to contain a radio port
+    uint64_t count_p_bad=0;
+};
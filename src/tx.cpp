@@ -25,6 +25,7 @@
 #include <fcntl.h>
 #include <unistd.h>
 #include <poll.h>
+#include <sys/epoll.h>
 #include <ctime>
 #include <sys/resource.h>
 #include <cassert>
@@ -47,11 +48,95 @@ static FEC_VARIABLE_INPUT_TYPE convert(const Options& options){
     assert(false);
 }
 
-WBTransmitter::WBTransmitter(RadiotapHeader radiotapHeader,const Options& options1) :
+static std::unique_ptr<IRawPacketInjector> createInjectorForCard(const Options& options,const std::string& wlan){
+    switch (options.injector) {
+        case InjectorType::RAW_SOCKET:
+            return std::make_unique<RawSocketTransmitter>(wlan);
+        case InjectorType::TX_RING:
+            return std::make_unique<TxRingTransmitter>(wlan);
+        default:
+            return std::make_unique<PcapTransmitter>(wlan);
+    }
+}
+
+static RadiotapHeader::UserSelectableParams withOverrides(RadiotapHeader::UserSelectableParams params,const int mcsIndex,const int stbc=-1){
+    if(mcsIndex>=0){
+        params.mcs_index=mcsIndex;
+    }
+    if(stbc>=0){
+        params.stbc=stbc;
+    }
+    return params;
+}
+
+WBInjector::WBInjector(const RadiotapHeader::UserSelectableParams& wifiParams,const Options& options1,const std::size_t nStreams):
+        options(options1){
+    // each card gets its own pacer, since the cards might be on different channels
+    std::vector<std::unique_ptr<IRawPacketInjector>> cards;
+    for(const auto& wlan:options.wlans){
+        auto card=createInjectorForCard(options,wlan);
+        if(options.pacing_airtime_percentage>0){
+            const AirtimePacer pacer(wifiParams,std::min(options.pacing_airtime_percentage,100)/100.0);
+            auto pacedInjector=std::make_unique<PacedInjector>(std::move(card),pacer);
+            mPacedInjectors.push_back(pacedInjector.get());
+            card=std::move(pacedInjector);
+        }
+        cards.push_back(std::move(card));
+    }
+    if(cards.size()==1){
+        mInjector=std::move(cards[0]);
+    }else{
+        auto multiCardInjector=std::make_unique<MultiCardInjector>(std::move(cards),options.multi_card_mode);
+        mMultiCardInjector=multiCardInjector.get();
+        mInjector=std::move(multiCardInjector);
+    }
+    if(options.injection_queue_size>0){
+        auto threadedInjector=std::make_unique<ThreadedInjector>(std::move(mInjector),options.injection_queue_size,std::chrono::milliseconds(options.max_latency_ms),nStreams);
+        mThreadedInjector=threadedInjector.get();
+        mInjector=std::move(threadedInjector);
+    }
+}
+
+void WBInjector::selectStream(const std::size_t streamIdx) {
+    if(mThreadedInjector){
+        mThreadedInjector->setPriority(streamIdx);
+    }
+}
+
+void WBInjector::setGroup(const uint64_t groupId,const bool lowPriority) {
+    if(mThreadedInjector){
+        mThreadedInjector->setGroup(groupId,lowPriority);
+    }
+}
+
+void WBInjector::logStats(std::ostream& out)const {
+    if(mThreadedInjector){
+        out<<" Queue(max:"<<mThreadedInjector->getMaxQueueOccupancyAndReset()<<"/"<<mThreadedInjector->getQueueCapacity()
+           <<" dropped:"<<mThreadedInjector->getNDroppedPackets()<<" avgInjection:"<<MyTimeHelper::R(mThreadedInjector->getAvgInjectionTime())
+           <<" maxDelay:"<<MyTimeHelper::R(mThreadedInjector->getMaxQueueingDelayAndReset())<<")";
+        if(options.max_latency_ms>0){
+            out<<" Stale(blocks:"<<mThreadedInjector->getNDroppedGroups()<<" packets:"<<mThreadedInjector->getNDroppedStalePackets()<<")";
+        }
+    }
+    for(const auto* pacedInjector:mPacedInjectors){
+        out<<" Pacer(delayed:"<<pacedInjector->getNDelayedPackets()<<" maxDelay:"<<MyTimeHelper::R(pacedInjector->getMaxPacingDelayAndReset())<<")";
+    }
+    if(mMultiCardInjector){
+        for(std::size_t i=0;i<mMultiCardInjector->getNCards();i++){
+            out<<" Card"<<i<<"("<<mMultiCardInjector->getNInjectedPackets(i)<<" avgInjection:"<<MyTimeHelper::R(mMultiCardInjector->getAvgInjectionTime(i))<<")";
+        }
+    }
+}
+
+WBTransmitter::WBTransmitter(const RadiotapHeader::UserSelectableParams& wifiParams,const Options& options1,WBInjector& injector,const std::size_t streamIdx) :
         options(options1),
-        mPcapTransmitter(options.wlan),
-        mEncryptor(options.keypair),
-        mRadiotapHeader(radiotapHeader),
+        mInjector(injector),
+        mStreamIdx(streamIdx),
+        mEncryptor(options.keypair,false,options.authenticate_only ? EncryptionMode::AUTHENTICATE_ONLY : EncryptionMode::ENCRYPT_AND_AUTHENTICATE,selectCipher(options.cipher)),
+        mRadiotapHeaders{RadiotapHeader(wifiParams),
+                         RadiotapHeader(withOverrides(wifiParams,options.secondary_mcs_index,options.secondary_stbc)),
+                         RadiotapHeader(withOverrides(wifiParams,options.session_key_mcs_index))},
+        mFrameBuffer{RadiotapIeee80211Template(mRadiotapHeaders[PRIMARY]),{}},
         // FEC is disabled if k is integer and 0
         IS_FEC_DISABLED(options.fec_k.index() == 0 && std::get<int>(options.fec_k) == 0),
         // FEC is variable if k is an string
@@ -69,7 +154,11 @@ WBTransmitter::WBTransmitter(RadiotapHeader radiotapHeader,const Options& option
         sessionKeyPacket.MAX_N_FRAGMENTS_PER_BLOCK=FECEncoder::calculateN(kMax,options.fec_percentage);
     }
     mInputSocket= SocketHelper::openUdpSocketForReceiving(options.udp_port);
-    fprintf(stderr, "WB-TX Listen on UDP Port %d assigned ID %d assigned WLAN %s\n", options.udp_port,options.radio_port,options.wlan.c_str());
+    std::stringstream wlans;
+    for(const auto& wlan:options.wlans){
+        wlans<<wlan<<" ";
+    }
+    fprintf(stderr, "WB-TX Listen on UDP Port %d assigned ID %d assigned WLAN %s\n", options.udp_port,options.radio_port,wlans.str().c_str());
     // the rx needs to know if FEC is enabled or disabled. Note, both variable and fixed fec counts as FEC enabled
     sessionKeyPacket.IS_FEC_ENABLED=!IS_FEC_DISABLED;
 }
@@ -79,16 +168,47 @@ WBTransmitter::~WBTransmitter() {
 }
 
 
+void WBTransmitter::writeNextIeee80211Params() {
+    mFrameBuffer.headers.writeParams(options.radio_port, ieee80211_seq);
+    ieee80211_seq += 16;
+}
+
+void WBTransmitter::selectRadiotapHeader(const RadiotapHeaderType type) {
+    if(type==mCurrentRadiotapHeaderType)return;
+    mFrameBuffer.headers.setRadiotapHeader(mRadiotapHeaders[type]);
+    mCurrentRadiotapHeaderType=type;
+}
+
 void WBTransmitter::sendPacket(const AbstractWBPacket& abstractWbPacket) {
     //std::cout << "WBTransmitter::sendPacket\n";
-    mIeee80211Header.writeParams(options.radio_port, ieee80211_seq);
-    ieee80211_seq += 16;
-    //mIeee80211Header.printSequenceControl();
+    writeNextIeee80211Params();
+    // keep the packet order
+    flushQueuedPackets();
+    mInjector.selectStream(mStreamIdx);
+    const auto injectionTime=mInjector.get().injectPacket(mFrameBuffer.headers,abstractWbPacket);
+    nInjectedPackets++;
+    checkInjectionTime(injectionTime);
+}
 
-    const auto injectionTime=mPcapTransmitter.injectPacket(mRadiotapHeader,mIeee80211Header,abstractWbPacket);
+void WBTransmitter::sendFrameBuffer(const std::size_t packetSize) {
+    writeNextIeee80211Params();
+    mInjector.get().queuePacket((const uint8_t*)&mFrameBuffer,packetSize);
+    nQueuedPackets++;
     nInjectedPackets++;
+}
+
+void WBTransmitter::flushQueuedPackets() {
+    if(nQueuedPackets==0)return;
+    const auto injectionTime=mInjector.get().flush();
+    checkInjectionTime(injectionTime/nQueuedPackets);
+    nQueuedPackets=0;
+}
+
+void WBTransmitter::checkInjectionTime(const std::chrono::steady_clock::duration injectionTimePerPacket) {
 #ifdef ENABLE_ADVANCED_DEBUGGING
-    pcapInjectionTime.add(injectionTime);
+    // if injection is done on its own thread, the time is measured there (see ThreadedInjector)
+    if(mInjector.isInjectingOnOwnThread())return;
+    pcapInjectionTime.add(injectionTimePerPacket);
     if(pcapInjectionTime.getMax()>std::chrono::milliseconds (1)){
         std::cerr<<"Injecting PCAP packet took really long:"<<pcapInjectionTime.getAvgReadable()<<"\n";
         pcapInjectionTime.reset();
@@ -98,10 +218,16 @@ void WBTransmitter::sendPacket(const AbstractWBPacket& abstractWbPacket) {
 
 void WBTransmitter::sendFecPrimaryOrSecondaryFragment(const uint64_t nonce, const uint8_t* payload, const std::size_t payloadSize) {
     //std::cout << "WBTransmitter::sendFecBlock"<<(int)wbDataPacket.payloadSize<<"\n";
+    assert(payloadSize<=FEC_MAX_PACKET_SIZE);
+    mInjector.selectStream(mStreamIdx);
+    // all fragments of a block are only useful together
+    mInjector.setGroup(IS_FEC_DISABLED ? nonce : fecNonceFrom(nonce).blockIdx,mCurrentPacketIsNonReference);
+    selectRadiotapHeader((!IS_FEC_DISABLED && fecNonceFrom(nonce).flag==1) ? SECONDARY : PRIMARY);
     const WBDataHeader wbDataHeader(nonce);
-    const auto encryptedData=mEncryptor.encryptPacket(nonce,payload,payloadSize,wbDataHeader);
+    memcpy(mFrameBuffer.body.data(),&wbDataHeader,sizeof(WBDataHeader));
+    const auto encryptedSize=mEncryptor.encryptPacket(nonce,payload,payloadSize,wbDataHeader,mFrameBuffer.body.data()+sizeof(WBDataHeader));
     //
-    sendPacket({(const uint8_t*)&wbDataHeader,sizeof(WBDataHeader),encryptedData.data(),encryptedData.size()});
+    sendFrameBuffer(FRAME_BUFFER_HEADERS_SIZE+encryptedSize);
 #ifdef ENABLE_ADVANCED_DEBUGGING
     //LatencyTestingPacket latencyTestingPacket;
     //sendPacket((uint8_t*)&latencyTestingPacket,sizeof(latencyTestingPacket));
@@ -110,6 +236,7 @@ void WBTransmitter::sendFecPrimaryOrSecondaryFragment(const uint64_t nonce, cons
 
 void WBTransmitter::sendSessionKey() {
     std::cout << "sendSessionKey()\n";
+    selectRadiotapHeader(SESSION_KEY);
     sendPacket({(uint8_t *)&sessionKeyPacket, WBSessionKeyPacket::SIZE_BYTES});
 }
 
@@ -118,20 +245,24 @@ void WBTransmitter::processInputPacket(const uint8_t *buf, size_t size) {
     // this calls a callback internally
     if(IS_FEC_DISABLED){
         mFecDisabledEncoder->encodePacket(buf,size);
+        flushQueuedPackets();
     }else{
         if(IS_FEC_VARIABLE){
             // variable k
             bool endBlock=false;
             if(fecVariableInputType==FEC_VARIABLE_INPUT_TYPE::h264){
                 endBlock=RTPLockup::h264_end_block(buf,size);
+                mCurrentPacketIsNonReference=RTPLockup::h264_is_non_reference(buf,size);
             }else{
                 endBlock=RTPLockup::h265_end_block(buf,size);
+                mCurrentPacketIsNonReference=RTPLockup::h265_is_non_reference(buf,size);
             }
             mFecEncoder->encodePacket(buf,size,endBlock);
         }else{
             // fixed k
             mFecEncoder->encodePacket(buf,size);
         }
+        flushQueuedPackets();
         if(mFecEncoder->resetOnOverflow()){
             // running out of sequence numbers should never happen during the lifetime of the TX instance, but handle it properly anyways
             mEncryptor.makeNewSessionKey(sessionKeyPacket.sessionKeyNonce, sessionKeyPacket.sessionKeyData);
@@ -140,82 +271,163 @@ void WBTransmitter::processInputPacket(const uint8_t *buf, size_t size) {
     }
 }
 
-void WBTransmitter::loop() {
+void WBTransmitter::sendSessionKeyOnStartup() {
+    for(int i=0;i<5;i++){
+        sendSessionKey();
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+}
+
+bool WBTransmitter::processNextInputPacket(uint8_t* buf,const std::size_t bufSize) {
+    const ssize_t message_length = recv(mInputSocket, buf,bufSize, MSG_DONTWAIT);
+    if(message_length<0){
+        if(errno==EAGAIN || errno==EWOULDBLOCK){
+            return false;
+        }
+        if (errno == EINTR){
+            std::cout<<"Got EINTR"<<"\n";
+            return false;
+        }
+        throw std::runtime_error(StringFormat::convert("recvfrom error: %s", strerror(errno)));
+    }
+    if(message_length==0)return true;
+    if(message_length>FEC_MAX_PAYLOAD_SIZE){
+        throw std::runtime_error(StringFormat::convert("Error: This link doesn't support payload exceeding %d", FEC_MAX_PAYLOAD_SIZE));
+    }
+    nPacketsFromUdpPort++;
+    const auto cur_ts=std::chrono::steady_clock::now();
+    // send session key in SESSION_KEY_ANNOUNCE_DELTA intervals
+    if ((cur_ts >= session_key_announce_ts) ) {
+        // Announce session key
+        sendSessionKey();
+        session_key_announce_ts = cur_ts + SESSION_KEY_ANNOUNCE_DELTA;
+    }
+    processInputPacket(buf, message_length);
+    return true;
+}
+
+void WBTransmitter::logStats(std::ostream& out,const bool withRadioPort)const {
+    if(withRadioPort){
+        out<<(int)options.radio_port<<"=";
+    }
+    out<<nPacketsFromUdpPort<<":"<<nInjectedPackets;
+}
+
+// Serve all streams with one thread until nothing goes completely wrong.
+// @param streams: ordered by priority (the first one is the highest), same order as in the WBInjector
+static void loop(const std::vector<std::unique_ptr<WBTransmitter>>& streams,const WBInjector& injector){
     constexpr auto MAX_UDP_PAYLOAD_SIZE=65507;
+    constexpr auto LOG_INTERVAL=std::chrono::milliseconds(1000);
+    const auto INIT_TIME=std::chrono::steady_clock::now();
     // If we'd use a smaller buffer, in case the user doesn't respect the max packet size, the OS will silently drop all bytes exceeding FEC_MAX_PAYLOAD_BYTES.
     // This way we can throw an error in case the above happens.
     std::array<uint8_t,MAX_UDP_PAYLOAD_SIZE> buf{};
-    std::chrono::steady_clock::time_point session_key_announce_ts{};
     std::chrono::steady_clock::time_point log_ts{};
-    // send the key a couple of times on startup to increase the likeliness it is received
-    bool firstTime=true;
-    SocketHelper::setSocketReceiveTimeout(mInputSocket,LOG_INTERVAL);
+    // the loop only exits by throwing, the fd is closed then
+    struct EpollFd{
+        const int fd;
+        ~EpollFd(){
+            close(fd);
+        }
+    };
+    const EpollFd epoll{epoll_create1(EPOLL_CLOEXEC)};
+    if(epoll.fd<0){
+        throw std::runtime_error(StringFormat::convert("epoll_create1 error: %s", strerror(errno)));
+    }
+    for(std::size_t i=0;i<streams.size();i++){
+        epoll_event event{};
+        event.events=EPOLLIN;
+        event.data.u64=i;
+        if(epoll_ctl(epoll.fd,EPOLL_CTL_ADD,streams[i]->getInputSocket(),&event)!=0){
+            throw std::runtime_error(StringFormat::convert("epoll_ctl error: %s", strerror(errno)));
+        }
+    }
+    // send the session key a couple of times on startup
+    for(const auto& stream:streams){
+        stream->sendSessionKeyOnStartup();
+    }
+    std::vector<epoll_event> events(streams.size());
+    std::vector<bool> isReadable(streams.size());
+    // marks all streams that have data as readable (streams that are already marked stay readable)
+    const auto pollReadable=[&epoll,&events,&isReadable](const int timeoutMs){
+        const int nEvents=epoll_wait(epoll.fd,events.data(),(int)events.size(),timeoutMs);
+        if(nEvents<0 && errno!=EINTR){
+            throw std::runtime_error(StringFormat::convert("epoll_wait error: %s", strerror(errno)));
+        }
+        for(int i=0;i<nEvents;i++){
+            isReadable[events[i].data.u64]=true;
+        }
+    };
     for(;;){
-        // send the session key a couple of times on startup
-        if(firstTime){
-            for(int i=0;i<5;i++){
-                sendSessionKey();
-                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        std::fill(isReadable.begin(),isReadable.end(),false);
+        pollReadable((int)LOG_INTERVAL.count());
+        // Strict priority: always read the next packet of the highest priority stream that is readable, until all sockets are drained.
+        // Before each packet of a lower priority stream the sockets are polled again (without blocking), such that a packet of a
+        // higher priority stream that arrived in the meantime is read first. Note that this only orders the reading - if injection
+        // is done on its own thread (-Q), the packets queued for injection are ordered by priority, too.
+        for(;;){
+            auto highest=std::find(isReadable.begin(),isReadable.end(),true);
+            if(highest==isReadable.end())break;
+            if(highest!=isReadable.begin()){
+                pollReadable(0);
+                highest=std::find(isReadable.begin(),isReadable.end(),true);
             }
-            firstTime=false;
+            const std::size_t idx=highest-isReadable.begin();
+            isReadable[idx]=streams[idx]->processNextInputPacket(buf.data(),buf.size());
         }
-
-        // we set the timeout earlier when creating the socket
-        const ssize_t message_length = recvfrom(mInputSocket, buf.data(),buf.size(), 0, nullptr, nullptr);
         if(std::chrono::steady_clock::now()>=log_ts){
             const auto runTimeMs=std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now()-INIT_TIME).count();
-            std::cout<<runTimeMs<<"\tTX "<<nPacketsFromUdpPort<<":"<<nInjectedPackets<<"\n";
-            log_ts= std::chrono::steady_clock::now() + WBTransmitter::LOG_INTERVAL;
-        }
-        if(message_length>0){
-            if(message_length>FEC_MAX_PAYLOAD_SIZE){
-                throw std::runtime_error(StringFormat::convert("Error: This link doesn't support payload exceeding %d", FEC_MAX_PAYLOAD_SIZE));
-            }
-            nPacketsFromUdpPort++;
-            const auto cur_ts=std::chrono::steady_clock::now();
-            // send session key in SESSION_KEY_ANNOUNCE_DELTA intervals
-            if ((cur_ts >= session_key_announce_ts) ) {
-                // Announce session key
-                sendSessionKey();
-                session_key_announce_ts = cur_ts + SESSION_KEY_ANNOUNCE_DELTA;
-            }
-            processInputPacket(buf.data(), message_length);
-        }else{
-            if(errno==EAGAIN || errno==EWOULDBLOCK){
-                // timeout
-                continue;
-            }
-            if (errno == EINTR){
-                std::cout<<"Got EINTR"<<"\n";
-                continue;
+            std::cout<<runTimeMs<<"\tTX";
+            for(const auto& stream:streams){
+                std::cout<<" ";
+                stream->logStats(std::cout,streams.size()>1);
             }
-            throw std::runtime_error(StringFormat::convert("recvfrom error: %s", strerror(errno)));
+            injector.logStats(std::cout);
+            std::cout<<"\n";
+            log_ts= std::chrono::steady_clock::now() + LOG_INTERVAL;
         }
     }
 }
 
+// @param fecK: either a number or h264 / h265 (variable k)
+static std::variant<int,std::string> parseFecK(const std::string& fecK){
+    if(fecK==std::string("h264") || fecK==std::string("h265")){
+        return fecK;
+    }
+    return (int)std::stoi(fecK);
+}
+
+// @param stream: udp_port:radio_port:fec_k, everything else is the same as in @param options
+static Options parseStream(const std::string& stream,const Options& options){
+    Options ret=options;
+    const auto firstColon=stream.find(':');
+    const auto secondColon=firstColon==std::string::npos ? firstColon : stream.find(':',firstColon+1);
+    if(secondColon==std::string::npos){
+        throw std::runtime_error(StringFormat::convert("Invalid stream %s, expected udp_port:radio_port:fec_k",stream.c_str()));
+    }
+    ret.udp_port=std::stoi(stream.substr(0,firstColon));
+    ret.radio_port=std::stoi(stream.substr(firstColon+1,secondColon-firstColon-1));
+    ret.fec_k=parseFecK(stream.substr(secondColon+1));
+    return ret;
+}
 
 int main(int argc, char *const *argv) {
     int opt;
     Options options{};
+    // udp_port:radio_port:fec_k, if empty there is only one stream (-u -r -k)
+    std::vector<std::string> streams;
 
     RadiotapHeader::UserSelectableParams wifiParams{20, false, 0, false, 1};
 
     std::cout << "MAX_PAYLOAD_SIZE:" << FEC_MAX_PAYLOAD_SIZE << "\n";
 
-    while ((opt = getopt(argc, argv, "K:k:p:u:r:B:G:S:L:M:n:")) != -1) {
+    while ((opt = getopt(argc, argv, "K:k:p:u:r:B:G:S:L:M:a:C:T:Q:A:D:b:m:s:e:x:n:")) != -1) {
         switch (opt) {
             case 'K':
                 options.keypair = optarg;
                 break;
             case 'k':
-                if(std::string(optarg)==std::string("h264")
-                || std::string(optarg)==std::string("h265")){
-                    std::cout<<"LolX"<<std::string(optarg)<<"\n";
-                    options.fec_k=std::string(optarg);
-                }else{
-                    options.fec_k=(int)std::stoi(optarg);
-                }
+                options.fec_k=parseFecK(optarg);
                 break;
             case 'p':
                 options.fec_percentage=std::stoi(optarg);
@@ -241,17 +453,50 @@ int main(int argc, char *const *argv) {
             case 'M':
                 wifiParams.mcs_index = std::stoi(optarg);
                 break;
+            case 'a':
+                options.authenticate_only = std::stoi(optarg)!=0;
+                break;
+            case 'C':
+                options.cipher = std::stoi(optarg)==1 ? Cipher::AES256GCM : Cipher::CHACHA20_POLY1305;
+                break;
+            case 'T':
+                options.injector = (InjectorType)std::clamp(std::stoi(optarg),0,2);
+                break;
+            case 'Q':
+                options.injection_queue_size = std::max(std::stoi(optarg),0);
+                break;
+            case 'A':
+                options.pacing_airtime_percentage = std::clamp(std::stoi(optarg),0,100);
+                break;
+            case 'D':
+                options.max_latency_ms = std::max(std::stoi(optarg),0);
+                break;
+            case 'b':
+                options.multi_card_mode = std::stoi(optarg)==1 ? MultiCardInjector::Mode::STRIPE : MultiCardInjector::Mode::DUPLICATE;
+                break;
+            case 'm':
+                options.secondary_mcs_index = std::stoi(optarg);
+                break;
+            case 's':
+                options.secondary_stbc = std::stoi(optarg);
+                break;
+            case 'e':
+                options.session_key_mcs_index = std::stoi(optarg);
+                break;
+            case 'x':
+                streams.emplace_back(optarg);
+                break;
             case 'n':
                 std::cerr<<"-n is deprecated. Please read https://github.com/Consti10/wifibroadcast/blob/master/README.md \n";
                 exit(1);
             default: /* '?' */
             show_usage:
                 fprintf(stderr,
-                        "Usage: %s [-K tx_key] [-k FEC_K] [-p FEC_PERCENTAGE] [-u udp_port] [-r radio_port] [-B bandwidth] [-G guard_interval] [-S stbc] [-L ldpc] [-M mcs_index] interface \n",
+                        "Usage: %s [-K tx_key] [-k FEC_K] [-p FEC_PERCENTAGE] [-u udp_port] [-r radio_port] [-B bandwidth] [-G guard_interval] [-S stbc] [-L ldpc] [-M mcs_index] [-a authenticate_only(0/1)] [-C cipher(0=chacha20poly1305,1=aes256gcm)] [-T injector(0=pcap,1=raw socket,2=tx ring)] [-Q injection_queue_size(0=inject on the main thread)] [-A pacing_airtime_percentage(0=no pacing)] [-D max_latency_ms(0=never drop)] [-b multi_card_mode(0=duplicate,1=stripe)] [-m secondary_mcs_index] [-s secondary_stbc] [-e session_key_mcs_index] [-x udp_port:radio_port:fec_k (repeatable, one stream each, highest priority first)] interface1 [interface2 ...] \n",
                         argv[0]);
                 fprintf(stderr,
-                        "Default: K='%s', k=%d, n=%d, udp_port=%d, radio_port=%d bandwidth=%d guard_interval=%s stbc=%d ldpc=%d mcs_index=%d \n",
-                        "none", std::get<int>(options.fec_k), options.fec_percentage, options.udp_port, options.radio_port, wifiParams.bandwidth, wifiParams.short_gi ? "short" : "long", wifiParams.stbc, wifiParams.ldpc, wifiParams.mcs_index);
+                        "Default: K='%s', k=%d, n=%d, udp_port=%d, radio_port=%d bandwidth=%d guard_interval=%s stbc=%d ldpc=%d mcs_index=%d authenticate_only=%d cipher=%d injector=%d injection_queue_size=%d pacing_airtime_percentage=%d max_latency_ms=%d multi_card_mode=%d secondary_mcs_index=%d secondary_stbc=%d session_key_mcs_index=%d (-1=same as primary) \n",
+                        "none", std::get<int>(options.fec_k), options.fec_percentage, options.udp_port, options.radio_port, wifiParams.bandwidth, wifiParams.short_gi ? "short" : "long", wifiParams.stbc, wifiParams.ldpc, wifiParams.mcs_index, (int)options.authenticate_only, (int)options.cipher, (int)options.injector, options.injection_queue_size, options.pacing_airtime_percentage, options.max_latency_ms, (int)options.multi_card_mode, options.secondary_mcs_index, options.secondary_stbc, options.session_key_mcs_index);
                 fprintf(stderr, "Radio MTU: %lu\n", (unsigned long) FEC_MAX_PAYLOAD_SIZE);
                 fprintf(stderr, "WFB version "
                 WFB_VERSION
@@ -262,42 +507,74 @@ int main(int argc, char *const *argv) {
     if (optind >= argc) {
         goto show_usage;
     }
-    options.wlan=argv[optind];
+    for(int i=optind;i<argc;i++){
+        options.wlans.emplace_back(argv[i]);
+    }
 
     RadiotapHeader radiotapHeader{wifiParams};
+    if(options.max_latency_ms>0 && options.injection_queue_size==0){
+        std::cout<<"-D only works with an injection queue (-Q), no blocks will be dropped\n";
+    }
 
     //RadiotapHelper::debugRadiotapHeader((uint8_t*)&radiotapHeader,sizeof(RadiotapHeader));
     //RadiotapHelper::debugRadiotapHeader((uint8_t*)&OldRadiotapHeaders::u8aRadiotapHeader80211n, sizeof(OldRadiotapHeaders::u8aRadiotapHeader80211n));
     //RadiotapHelper::debugRadiotapHeader((uint8_t*)&OldRadiotapHeaders::u8aRadiotapHeader, sizeof(OldRadiotapHeaders::u8aRadiotapHeader));
     SchedulingHelper::setThreadParamsMaxRealtime();
 
-    if(options.fec_k.index() == 0){
-        // If the user selected -k as an integer number
-        const int k=std::get<int>(options.fec_k);
-        if(k==0){
-            std::cout<<"FEC is disabled. -p won't do anything\n";
-        }else{
-            const auto n=FECEncoder::calculateN(k,options.fec_percentage);
-            if(n>MAX_TOTAL_FRAGMENTS_PER_BLOCK){
-                std::cout<<"Please select a smaller -p (FEC_PERCENTAGE) value\n";
+    // one process can serve multiple streams, they share the injector
+    std::vector<Options> streamOptions;
+    try {
+        for(const auto& stream:streams){
+            streamOptions.push_back(parseStream(stream,options));
+        }
+    } catch (std::exception &e) {
+        fprintf(stderr, "Error: %s\n", e.what());
+        exit(1);
+    }
+    if(streamOptions.empty()){
+        streamOptions.push_back(options);
+    }
+    for(std::size_t i=0;i<streamOptions.size();i++){
+        for(std::size_t j=0;j<i;j++){
+            if(streamOptions[i].radio_port==streamOptions[j].radio_port || streamOptions[i].udp_port==streamOptions[j].udp_port){
+                std::cout<<"Each stream needs its own udp port and radio port\n";
                 exit(1);
             }
-            std::cout<<"FEC is enabled and fixed. A block always consists of (K:N) fragments ("<<k<<":"<<n<<")\n";
         }
-    }else{
-        // If the user selected -k h264 (as a string)
-        std::cout << "FEC is enabled and variable, can only be used in conjunction with h264/h265. FEC_PERCENTAGE(overhead):" << options.fec_percentage <<" type:"<<std::get<std::string>(options.fec_k)<<"\n";
-        if(options.fec_percentage > 100){
-            std::cout<<"Using more than 100% fec overhead (=2x the bandwidth) is not supported\n";
-            //limit of the fec library, would need to go back to zfec
-            exit(1);
+    }
+
+    for(const auto& stream:streamOptions){
+        if(stream.fec_k.index() == 0){
+            // If the user selected -k as an integer number
+            const int k=std::get<int>(stream.fec_k);
+            if(k==0){
+                std::cout<<"FEC is disabled. -p won't do anything\n";
+            }else{
+                const auto n=FECEncoder::calculateN(k,stream.fec_percentage);
+                if(n>MAX_TOTAL_FRAGMENTS_PER_BLOCK){
+                    std::cout<<"Please select a smaller -p (FEC_PERCENTAGE) value\n";
+                    exit(1);
+                }
+                std::cout<<"FEC is enabled and fixed. A block always consists of (K:N) fragments ("<<k<<":"<<n<<")\n";
+            }
+        }else{
+            // If the user selected -k h264 (as a string)
+            std::cout << "FEC is enabled and variable, can only be used in conjunction with h264/h265. FEC_PERCENTAGE(overhead):" << stream.fec_percentage <<" type:"<<std::get<std::string>(stream.fec_k)<<"\n";
+            if(stream.fec_percentage > 100){
+                std::cout<<"Using more than 100% fec overhead (=2x the bandwidth) is not supported\n";
+                //limit of the fec library, would need to go back to zfec
+                exit(1);
+            }
         }
     }
 
     try {
-        std::shared_ptr<WBTransmitter> t = std::make_shared<WBTransmitter>(
-                radiotapHeader,options);
-        t->loop();
+        WBInjector injector(wifiParams,options,streamOptions.size());
+        std::vector<std::unique_ptr<WBTransmitter>> transmitters;
+        for(std::size_t i=0;i<streamOptions.size();i++){
+            transmitters.push_back(std::make_unique<WBTransmitter>(wifiParams,streamOptions[i],injector,i));
+        }
+        loop(transmitters,injector);
     } catch (std::runtime_error &e) {
         fprintf(stderr, "Error: %s\n", e.what());
         exit(1);
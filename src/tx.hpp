@@ -37,6 +37,8 @@
 #include <iostream>
 #include <variant>
 
+enum class InjectorType{PCAP=0,RAW_SOCKET=1,TX_RING=2};
+
 struct Options{
     // the radio port is what is used as an index to multiplex multiple streams (telemetry,video,...)
     // into the one wfb stream
@@ -47,24 +49,85 @@ struct Options{
     // make optional for ease of use - with no keypair given the default "seed" is used
     // std::string keypair="drone.key";
     std::optional<std::string> keypair=std::nullopt;
-    // wlan interface to send packets with
-    std::string wlan;
+    // wlan interface(s) to send packets with
+    std::vector<std::string> wlans;
+    // how packets are distributed if there is more than one wlan interface
+    MultiCardInjector::Mode multi_card_mode=MultiCardInjector::Mode::DUPLICATE;
+    // if not -1, secondary FEC fragments are injected with this mcs index / stbc (e.g. more robust than the primary fragments)
+    int secondary_mcs_index=-1;
+    int secondary_stbc=-1;
+    // if not -1, session key packets are injected with this mcs index
+    int session_key_mcs_index=-1;
     // either fixed or variable. If int==fixed, if string==variable but hook needs to be added (currently only hooked h264 and h265)
     std::variant<int,std::string> fec_k=8;
     int fec_percentage=50;
+    // only authenticate the data, but don't encrypt it (see EncryptionMode)
+    bool authenticate_only=false;
+    // AES256GCM is only used if it is available on this CPU (and it has to be available on the rx, too)
+    Cipher cipher=Cipher::CHACHA20_POLY1305;
+    // how the packets are injected, see RawTransmitter.hpp
+    InjectorType injector=InjectorType::PCAP;
+    // if not 0, packets are injected on their own thread, fed by a queue of this many packets (see ThreadedInjector)
+    int injection_queue_size=0;
+    // if not 0, packets are paced such that they take at most this share of the airtime (see AirtimePacer)
+    int pacing_airtime_percentage=0;
+    // if not 0, blocks that could not be injected within this many ms are dropped as a whole (needs injection_queue_size>0)
+    int max_latency_ms=0;
 };
 enum FEC_VARIABLE_INPUT_TYPE{none,h264,h265};
 
+// The injection part of wfb_tx: one injector per card (optionally paced), combined if there is more than one card, and optionally
+// injecting on its own thread (see RawTransmitter.hpp). One instance is shared by all streams (WBTransmitter) of one wfb_tx process.
+// If injection is done on its own thread, each stream gets its own queue, and streams with a higher priority are injected first.
+class WBInjector{
+public:
+    // @param nStreams: n of streams that share this injector, the stream index is also the priority (0 is the highest)
+    WBInjector(const RadiotapHeader::UserSelectableParams& wifiParams,const Options& options,std::size_t nStreams);
+    // packets queued / injected after this call belong to the stream @param streamIdx
+    void selectStream(std::size_t streamIdx);
+    // see ThreadedInjector::setGroup(), no-op if injection is done on the caller's thread
+    void setGroup(uint64_t groupId,bool lowPriority);
+    IRawPacketInjector& get(){
+        return *mInjector;
+    }
+    // if true, get() only queues the packets and the returned injection times are meaningless
+    bool isInjectingOnOwnThread()const{
+        return mThreadedInjector!=nullptr;
+    }
+    // statistics for console (without newline)
+    void logStats(std::ostream& out)const;
+private:
+    const Options& options;
+    // this one is used for injecting packets
+    std::unique_ptr<IRawPacketInjector> mInjector;
+    // not null if injection is done on its own thread (points to mInjector)
+    ThreadedInjector* mThreadedInjector=nullptr;
+    // one per card if pacing is enabled (owned by mInjector)
+    std::vector<PacedInjector*> mPacedInjectors;
+    // not null if there is more than one card (owned by mInjector)
+    MultiCardInjector* mMultiCardInjector=nullptr;
+};
+
 // WBTransmitter uses an UDP port as input for the data stream
 // Each input UDP port has to be assigned with a Unique ID to differentiate between streams on the RX
-// It does all the FEC encoding & encryption for this stream, then uses PcapTransmitter to inject the generated packets
+// It does all the FEC encoding & encryption for this stream, then uses the (shared) WBInjector to inject the generated packets
 // FEC can be either enabled or disabled.
 class WBTransmitter {
 public:
-    WBTransmitter(RadiotapHeader radiotapHeader,const Options& options1);
+    // @param streamIdx: the index of this stream in the WBInjector
+    WBTransmitter(const RadiotapHeader::UserSelectableParams& wifiParams,const Options& options1,WBInjector& injector,std::size_t streamIdx);
     ~WBTransmitter();
+    // send the session key a couple of times, to increase the likeliness it is received
+    void sendSessionKeyOnStartup();
+    // read one packet from the input socket (without blocking) and process it. @return false if there was no packet
+    bool processNextInputPacket(uint8_t* buf,std::size_t bufSize);
+    int getInputSocket()const{
+        return mInputSocket;
+    }
+    // statistics for console (without newline)
+    void logStats(std::ostream& out,bool withRadioPort)const;
 private:
-    const Options& options;
+    const Options options;
     // process the input data stream
     void processInputPacket(const uint8_t *buf, size_t size);
     // send the current session key via WIFI (located in mEncryptor)
@@ -73,23 +136,47 @@ private:
     void sendFecPrimaryOrSecondaryFragment(const uint64_t nonce, const uint8_t* payload,const size_t payloadSize);
     // send packet by prefixing data with the current IEE and Radiotap header
     void sendPacket(const AbstractWBPacket& abstractWbPacket);
+    // patch the next IEE header into the frame buffer, then queue the first @param packetSize bytes of it
+    void sendFrameBuffer(std::size_t packetSize);
+    // patch the radio port and next sequence number into the preformatted headers
+    void writeNextIeee80211Params();
+    // the radiotap header is selected per packet, see Options::secondary_mcs_index
+    enum RadiotapHeaderType{PRIMARY=0,SECONDARY=1,SESSION_KEY=2};
+    // write the selected radiotap header into the preformatted headers (if it is not there already)
+    void selectRadiotapHeader(RadiotapHeaderType type);
+    // inject all packets queued while processing one input packet (e.g. all secondary fragments of a block) at once
+    void flushQueuedPackets();
+    // only if ENABLE_ADVANCED_DEBUGGING, warn if injecting one packet takes too long
+    void checkInjectionTime(std::chrono::steady_clock::duration injectionTimePerPacket);
     // this one is used for injecting packets
-    PcapTransmitter mPcapTransmitter;
-    //RawSocketTransmitter mPcapTransmitter;
+    WBInjector& mInjector;
+    const std::size_t mStreamIdx;
+    // set if the input packet that is currently processed belongs to a NALU that is not referenced by other frames
+    // (only known if the RTP stream is parsed, i.e. variable FEC k)
+    bool mCurrentPacketIsNonReference=false;
+    std::size_t nQueuedPackets=0;
     // the rx socket is set by opening the right UDP port
     int mInputSocket;
     // Used to encrypt the packets
     Encryptor mEncryptor;
-    // Used to inject packets
-    Ieee80211Header mIeee80211Header;
-    // this one never changes,also used to inject packets
-    const RadiotapHeader mRadiotapHeader;
     uint16_t ieee80211_seq=0;
+    // indexed by RadiotapHeaderType
+    const std::array<RadiotapHeader,3> mRadiotapHeaders;
+    RadiotapHeaderType mCurrentRadiotapHeaderType=PRIMARY;
+    // Data packets are encrypted directly into this buffer, behind the Radiotap, IEE and WBDataHeader (no allocation or copy per packet).
+    // The Radiotap and IEE header are preformatted once, only the radio port and sequence number are patched in place.
+    // The session key packet re-uses the same headers.
+    struct FrameBuffer{
+        RadiotapIeee80211Template headers;
+        std::array<uint8_t,sizeof(WBDataHeader)+FEC_MAX_PACKET_SIZE+crypto_aead_chacha20poly1305_ABYTES> body;
+    };
+    static_assert(sizeof(FrameBuffer)==RadiotapIeee80211Template::SIZE_BYTES+sizeof(FrameBuffer::body),"No padding allowed");
+    static constexpr auto FRAME_BUFFER_HEADERS_SIZE=RadiotapIeee80211Template::SIZE_BYTES+sizeof(WBDataHeader);
+    FrameBuffer mFrameBuffer;
     // statistics for console
     int64_t nPacketsFromUdpPort=0;
     int64_t nInjectedPackets=0;
-    const std::chrono::steady_clock::time_point INIT_TIME=std::chrono::steady_clock::now();
-    static constexpr const std::chrono::nanoseconds LOG_INTERVAL=std::chrono::milliseconds(1000);
+    std::chrono::steady_clock::time_point session_key_announce_ts{};
     Chronometer pcapInjectionTime{"PcapInjectionTime"};
     WBSessionKeyPacket sessionKeyPacket;
     const bool IS_FEC_DISABLED;
@@ -98,7 +185,4 @@ private:
     // On the tx, either one of those two is active at the same time
     std::unique_ptr<FECEncoder> mFecEncoder=nullptr;
     std::unique_ptr<FECDisabledEncoder> mFecDisabledEncoder=nullptr;
-public:
-    // run as long as nothing goes completely wrong
-    void loop();
 };
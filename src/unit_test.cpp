@@ -24,12 +24,18 @@
 #include <string>
 #include <chrono>
 #include <sstream>
+#include <thread>
+#include <functional>
 
 #include "wifibroadcast.hpp"
 #include "FECEnabled.hpp"
+#include "FECDisabled.hpp"
 
 #include "HelperSources/Helper.hpp"
 #include "Encryption.hpp"
+#include "RawTransmitter.hpp"
+#include "RawReceiver.hpp"
+#include "HelperSources/RTPHelper.hpp"
 
 // Simple unit testing for the FEC lib that doesn't require wifi cards
 
@@ -48,6 +54,120 @@ namespace TestFEC{
         assert(fecNonce2.number==number);
     }
 
+    static void testFragmentBitmap(){
+        FragmentBitmap bitmap;
+        assert(bitmap.count(0,FragmentBitmap::N_BITS)==0);
+        assert(bitmap.findFirstSet(0,FragmentBitmap::N_BITS)==FragmentBitmap::N_BITS);
+        for(const unsigned int idx:{0u,1u,63u,64u,130u,255u}){
+            bitmap.set(idx);
+        }
+        assert(bitmap.test(63) && bitmap.test(64) && !bitmap.test(65));
+        assert(bitmap.count(0,FragmentBitmap::N_BITS)==6);
+        assert(bitmap.count(1,64)==2);
+        assert(bitmap.count(64,255)==2);
+        assert(bitmap.findFirstUnset(0,10)==2);
+        assert(bitmap.findFirstSet(2,FragmentBitmap::N_BITS)==63);
+        assert(bitmap.findFirstSet(65,FragmentBitmap::N_BITS)==130);
+        // set bit below the (exclusive) end of the range, in a later 64bit word than the start
+        assert(bitmap.findFirstSet(66,131)==130);
+        assert(bitmap.findFirstSet(1,64)==1);
+        // no set bit in the range, i.e. the end of the range is returned (bit 255 is not part of it)
+        assert(bitmap.findFirstSet(131,255)==255);
+        assert(bitmap.findFirstSet(65,100)==100);
+        assert(bitmap.findFirstSet(131,FragmentBitmap::N_BITS)==255);
+        for(unsigned int i=0;i<FragmentBitmap::N_BITS;i++){
+            bitmap.set(i);
+        }
+        assert(bitmap.findFirstUnset(0,FragmentBitmap::N_BITS)==FragmentBitmap::N_BITS);
+    }
+
+    // emulate 2 rx cards for FEC disabled, with duplicates, re-ordering and a packet that is too old
+    static void testFECDisabledDuplicates(){
+        std::cout<<"Test FEC disabled duplicates\n";
+        constexpr auto WINDOW_SIZE=128;
+        FECDisabledDecoder decoder(WINDOW_SIZE);
+        std::vector<uint64_t> testOut;
+        decoder.mSendDecodedPayloadCallback=[&testOut](const uint8_t * payload,std::size_t payloadSize)mutable{
+            assert(payloadSize==sizeof(uint64_t));
+            uint64_t seqNr;
+            memcpy(&seqNr,payload,payloadSize);
+            testOut.push_back(seqNr);
+        };
+        const auto add=[&decoder](const uint64_t seqNr,const int rxCardIdx){
+            std::vector<uint8_t> data(sizeof(uint64_t));
+            memcpy(data.data(),&seqNr,sizeof(uint64_t));
+            decoder.processRawDataBlockFecDisabled(seqNr,data,rxCardIdx);
+        };
+        for(uint64_t seqNr=0;seqNr<1000;seqNr++){
+            // card 0 gets every packet, card 1 lags behind and misses every 3rd packet
+            add(seqNr,0);
+            if(seqNr>=10 && seqNr%3!=0){
+                add(seqNr-10,1);
+            }
+        }
+        assert(testOut.size()==1000);
+        for(uint64_t i=0;i<testOut.size();i++){
+            assert(testOut[i]==i);
+        }
+        assert(decoder.count_duplicates_per_rx_card.size()==2);
+        assert(decoder.count_duplicates_per_rx_card[0]==0);
+        assert(decoder.count_duplicates_per_rx_card[1]>0);
+        assert(decoder.count_out_of_window==0);
+        // copies of already received packets are dropped before decryption, everything else has to be decrypted
+        const auto nDuplicatesCard1=decoder.count_duplicates_per_rx_card[1];
+        assert(decoder.dropAuthenticatedDuplicate(999,1));
+        assert(!decoder.dropAuthenticatedDuplicate(1000,1));
+        assert(decoder.count_duplicates_per_rx_card[1]==nDuplicatesCard1+1);
+        // a gap bigger than the window, then a packet that was never received but arrives after the gap
+        add(1000+WINDOW_SIZE*2,0);
+        add(1000+WINDOW_SIZE*2-1,1);
+        assert(testOut.size()==1002);
+        add(1000,0);
+        assert(decoder.count_out_of_window==1);
+        assert(testOut.size()==1002);
+    }
+
+    // FEC disabled with the re-order buffer enabled: gaps are filled in order, or released once the max delay has passed
+    static void testFECDisabledReorderBuffer(){
+        std::cout<<"Test FEC disabled re-order buffer\n";
+        constexpr auto MAX_DELAY=std::chrono::milliseconds(2);
+        FECDisabledDecoder decoder(FECDisabledDecoder::DEFAULT_WINDOW_SIZE,MAX_DELAY);
+        std::vector<uint64_t> testOut;
+        decoder.mSendDecodedPayloadCallback=[&testOut](const uint8_t * payload,std::size_t payloadSize)mutable{
+            uint64_t seqNr;
+            memcpy(&seqNr,payload,sizeof(uint64_t));
+            testOut.push_back(seqNr);
+        };
+        const auto add=[&decoder](const uint64_t seqNr){
+            std::vector<uint8_t> data(sizeof(uint64_t));
+            memcpy(data.data(),&seqNr,sizeof(uint64_t));
+            decoder.processRawDataBlockFecDisabled(seqNr,data);
+        };
+        add(0);
+        add(2);
+        add(3);
+        // 2 and 3 wait on 1
+        assert(testOut.size()==1);
+        add(1);
+        assert((testOut==std::vector<uint64_t>{0,1,2,3}));
+        assert(decoder.max_reorder_depth==2);
+        // 4 is lost, 5 is released once the max delay has passed
+        add(5);
+        decoder.releaseExpiredPackets();
+        assert(testOut.size()==4);
+        std::this_thread::sleep_for(MAX_DELAY*2);
+        decoder.releaseExpiredPackets();
+        assert((testOut==std::vector<uint64_t>{0,1,2,3,5}));
+        // 4 arrives too late, but is still forwarded
+        add(4);
+        assert(testOut.size()==6 && testOut.back()==4);
+        assert(decoder.count_reorder_late==1);
+        // a packet too far ahead releases everything in front of it
+        add(7);
+        add(6+FECDisabledDecoder::MAX_REORDER_BUFFER_SIZE*2);
+        assert(testOut.size()==7 && testOut.back()==7);
+    }
+
     // test without packet loss, fixed block size
     static void testWithoutPacketLoss(const int k, const int percentage, const std::vector<std::vector<uint8_t>>& testIn){
         std::cout<<"Test without packet loss. K:"<<k<<" P:"<<percentage<<" N_PACKETS:"<<testIn.size()<<"\n";
@@ -102,7 +222,7 @@ namespace TestFEC{
     static void testRxQueue(const int k, const int percentage){
         std::cout<<"Test rx queue. K:"<<k<<" P:"<<percentage<<"\n";
         const auto n=FECEncoder::calculateN(k,percentage);
-        constexpr auto QUEUE_SIZE=FECDecoder::RX_QUEUE_MAX_SIZE;
+        constexpr auto QUEUE_SIZE=FECDecoder::RX_QUEUE_DEFAULT_SIZE;
         const auto testIn=GenericHelper::createRandomDataBuffers(QUEUE_SIZE*k, FEC_MAX_PAYLOAD_SIZE, FEC_MAX_PAYLOAD_SIZE);
         FECEncoder encoder(k,percentage);
         FECDecoder decoder;
@@ -142,6 +262,409 @@ namespace TestFEC{
         }
     }
 
+    // Interleave more blocks than fit into the default rx queue, then make sure the adaptive rx queue grows once
+    // a fragment for a block that was removed due to the overflow arrives. The next time, the same re-ordering must not cause an overflow.
+    static void testAdaptiveRxQueue(const int k, const int percentage){
+        // with k==1 there is no re-ordering between the fragments of a block
+        assert(k>1);
+        std::cout<<"Test adaptive rx queue. K:"<<k<<" P:"<<percentage<<"\n";
+        const auto n=FECEncoder::calculateN(k,percentage);
+        constexpr auto N_INTERLEAVED_BLOCKS=FECDecoder::RX_QUEUE_DEFAULT_SIZE+2;
+        const auto testIn=GenericHelper::createRandomDataBuffers(2*N_INTERLEAVED_BLOCKS*k, FEC_MAX_PAYLOAD_SIZE, FEC_MAX_PAYLOAD_SIZE);
+        FECEncoder encoder(k,percentage);
+        FECDecoder decoder(MAX_TOTAL_FRAGMENTS_PER_BLOCK,false,false,true);
+        std::vector<std::pair<uint64_t,std::vector<uint8_t>>> fecPackets;
+        const auto cb1=[&fecPackets](const uint64_t nonce,const uint8_t* payload,const std::size_t payloadSize)mutable {
+            fecPackets.emplace_back(nonce,std::vector<uint8_t>(payload,payload +payloadSize));
+        };
+        encoder.outputDataCallback=cb1;
+        for(const auto& in:testIn){
+            encoder.encodePacket(in.data(),in.size());
+        }
+        std::vector<std::vector<uint8_t>> testOut;
+        const auto cb2=[&testOut](const uint8_t * payload,std::size_t payloadSize)mutable{
+            testOut.emplace_back(payload,payload+payloadSize);
+        };
+        decoder.mSendDecodedPayloadCallback=cb2;
+        // block 0, fragment 0, block 1, fragment 0, ... (primary fragments only)
+        const auto addInterleaved=[&](const int firstBlock){
+            for(int frIdx=0; frIdx < k; frIdx++){
+                for(int i=firstBlock;i<firstBlock+N_INTERLEAVED_BLOCKS;i++){
+                    const auto& packet=fecPackets.at(i*n + frIdx);
+                    decoder.validateAndProcessPacket(packet.first,packet.second);
+                }
+            }
+        };
+        addInterleaved(0);
+        assert(decoder.count_rx_queue_overflow>0);
+        assert(decoder.getRxQueueSize()==N_INTERLEAVED_BLOCKS);
+        assert(decoder.max_reorder_distance==N_INTERLEAVED_BLOCKS-1);
+        const auto countOverflow=decoder.count_rx_queue_overflow;
+        const auto outOffset=testOut.size();
+        addInterleaved(N_INTERLEAVED_BLOCKS);
+        assert(decoder.count_rx_queue_overflow==countOverflow);
+        assert(testOut.size()==outOffset+N_INTERLEAVED_BLOCKS*k);
+        for(int i=0;i<N_INTERLEAVED_BLOCKS*k;i++){
+            GenericHelper::assertVectorsEqual(testIn[N_INTERLEAVED_BLOCKS*k+i],testOut[outOffset+i]);
+        }
+    }
+
+    // Drop the first primary fragment and all secondary fragments of each block, such that no block can be recovered.
+    // Then make sure removeBlocksOlderThan() forwards the rest and counts the blocks as lost
+    static void testRemoveBlocksOlderThan(const int k, const int percentage){
+        // with k==1 there would be nothing left to forward
+        assert(k>1);
+        std::cout<<"Test remove blocks older than. K:"<<k<<" P:"<<percentage<<"\n";
+        constexpr auto N_BLOCKS=3;
+        const auto testIn=GenericHelper::createRandomDataBuffers(N_BLOCKS*k, FEC_MAX_PAYLOAD_SIZE, FEC_MAX_PAYLOAD_SIZE);
+        FECEncoder encoder(k,percentage);
+        FECDecoder decoder;
+        std::vector<std::vector<uint8_t>> testOut;
+        const auto cb1=[&decoder,k](const uint64_t nonce,const uint8_t* payload,const std::size_t payloadSize)mutable {
+            const FECNonce fecNonce=fecNonceFrom(nonce);
+            if(fecNonce.fragmentIdx==0 || fecNonce.fragmentIdx>=k){
+                return;
+            }
+            decoder.validateAndProcessPacket(nonce, std::vector<uint8_t>(payload,payload +payloadSize));
+        };
+        const auto cb2=[&testOut](const uint8_t * payload,std::size_t payloadSize)mutable{
+            testOut.emplace_back(payload,payload+payloadSize);
+        };
+        encoder.outputDataCallback=cb1;
+        decoder.mSendDecodedPayloadCallback=cb2;
+        for(const auto& in:testIn){
+            encoder.encodePacket(in.data(),in.size());
+        }
+        // nothing can be forwarded, since the first primary fragment of the oldest block is missing
+        assert(testOut.empty());
+        // a big max age shouldn't remove anything
+        assert(decoder.removeBlocksOlderThan(std::chrono::seconds(10))==0);
+        assert(testOut.empty());
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        assert(decoder.removeBlocksOlderThan(std::chrono::microseconds(1))==N_BLOCKS);
+        assert(decoder.count_blocks_lost==N_BLOCKS);
+        assert(testOut.size()==N_BLOCKS*(k-1));
+        for(int blockIdx=0;blockIdx<N_BLOCKS;blockIdx++){
+            for(int i=1;i<k;i++){
+                GenericHelper::assertVectorsEqual(testIn[blockIdx*k+i],testOut[blockIdx*(k-1)+i-1]);
+            }
+        }
+    }
+
+    static void testEarlyGiveUp(const int k, const int percentage){
+        // with k==1 there would be nothing left to forward
+        assert(k>1);
+        std::cout<<"Test early give up. K:"<<k<<" P:"<<percentage<<"\n";
+        constexpr auto N_BLOCKS=3;
+        const auto testIn=GenericHelper::createRandomDataBuffers(N_BLOCKS*k, FEC_MAX_PAYLOAD_SIZE, FEC_MAX_PAYLOAD_SIZE);
+        FECEncoder encoder(k,percentage);
+        FECDecoder decoder(MAX_TOTAL_FRAGMENTS_PER_BLOCK,true);
+        std::vector<std::vector<uint8_t>> testOut;
+        const auto cb1=[&decoder,k](const uint64_t nonce,const uint8_t* payload,const std::size_t payloadSize)mutable {
+            const FECNonce fecNonce=fecNonceFrom(nonce);
+            if(fecNonce.fragmentIdx==0 || fecNonce.fragmentIdx>=k){
+                return;
+            }
+            decoder.validateAndProcessPacket(nonce, std::vector<uint8_t>(payload,payload +payloadSize),0);
+        };
+        const auto cb2=[&testOut](const uint8_t * payload,std::size_t payloadSize)mutable{
+            testOut.emplace_back(payload,payload+payloadSize);
+        };
+        encoder.outputDataCallback=cb1;
+        decoder.mSendDecodedPayloadCallback=cb2;
+        for(const auto& in:testIn){
+            encoder.encodePacket(in.data(),in.size());
+        }
+        // every block except the last one has been given up as soon as the first fragment of the next block was received
+        assert(decoder.count_blocks_lost==N_BLOCKS-1);
+        assert(testOut.size()==(N_BLOCKS-1)*(k-1));
+        for(int blockIdx=0;blockIdx<N_BLOCKS-1;blockIdx++){
+            for(int i=1;i<k;i++){
+                GenericHelper::assertVectorsEqual(testIn[blockIdx*k+i],testOut[blockIdx*(k-1)+i-1]);
+            }
+        }
+    }
+
+    // Drop the first n-k+1 primary fragments of each block. As soon as k is known (last primary fragment), the decoder knows that
+    // at most n-k secondary fragments can still arrive, which is not enough - the block has to be given up right away.
+    static void testEarlyGiveUpMidBlock(const int k, const int percentage){
+        const int n=FECEncoder::calculateN(k,percentage);
+        const int nDropped=n-k+1;
+        // at least one primary fragment has to arrive, and the last one is needed for k
+        assert(nDropped<k);
+        std::cout<<"Test early give up mid block. K:"<<k<<" P:"<<percentage<<"\n";
+        constexpr auto N_BLOCKS=3;
+        const auto testIn=GenericHelper::createRandomDataBuffers(N_BLOCKS*k, FEC_MAX_PAYLOAD_SIZE, FEC_MAX_PAYLOAD_SIZE);
+        FECEncoder encoder(k,percentage);
+        FECDecoder decoder(n,true);
+        std::vector<std::vector<uint8_t>> testOut;
+        const auto cb1=[&decoder,&testOut,k,nDropped](const uint64_t nonce,const uint8_t* payload,const std::size_t payloadSize)mutable {
+            const FECNonce fecNonce=fecNonceFrom(nonce);
+            if(fecNonce.fragmentIdx<nDropped){
+                return;
+            }
+            decoder.validateAndProcessPacket(nonce, std::vector<uint8_t>(payload,payload +payloadSize),0);
+            if(fecNonce.fragmentIdx<k-1){
+                // k is not known yet
+                assert(decoder.count_blocks_lost==fecNonce.blockIdx);
+            }else{
+                // given up without waiting for the secondary fragments or the next block
+                assert(decoder.count_blocks_lost==fecNonce.blockIdx+1);
+                assert(testOut.size()==(fecNonce.blockIdx+1)*(k-nDropped));
+            }
+        };
+        const auto cb2=[&testOut](const uint8_t * payload,std::size_t payloadSize)mutable{
+            testOut.emplace_back(payload,payload+payloadSize);
+        };
+        encoder.outputDataCallback=cb1;
+        decoder.mSendDecodedPayloadCallback=cb2;
+        for(const auto& in:testIn){
+            encoder.encodePacket(in.data(),in.size());
+        }
+        assert(decoder.count_blocks_lost==N_BLOCKS);
+        for(int blockIdx=0;blockIdx<N_BLOCKS;blockIdx++){
+            for(int i=nDropped;i<k;i++){
+                GenericHelper::assertVectorsEqual(testIn[blockIdx*k+i],testOut[blockIdx*(k-nDropped)+i-nDropped]);
+            }
+        }
+    }
+
+    // Same loss pattern as testEarlyGiveUp() on rx card 0, but rx card 1 only receives the second fragment of the first block and then stops.
+    // Until card 0 is more than EARLY_GIVE_UP_MAX_RX_CARD_LAG_BLOCKS ahead, card 1 could still deliver the lost fragments -
+    // afterwards, it must no longer prevent giving up.
+    static void testEarlyGiveUpStaleRxCard(const int k, const int percentage){
+        assert(k>1);
+        std::cout<<"Test early give up stale rx card. K:"<<k<<" P:"<<percentage<<"\n";
+        constexpr int MAX_LAG=FECDecoder::EARLY_GIVE_UP_MAX_RX_CARD_LAG_BLOCKS;
+        constexpr auto N_BLOCKS=MAX_LAG+4;
+        static_assert(N_BLOCKS<FECDecoder::RX_QUEUE_DEFAULT_SIZE,"No rx queue overflow");
+        const auto testIn=GenericHelper::createRandomDataBuffers(N_BLOCKS*k, FEC_MAX_PAYLOAD_SIZE, FEC_MAX_PAYLOAD_SIZE);
+        FECEncoder encoder(k,percentage);
+        FECDecoder decoder(MAX_TOTAL_FRAGMENTS_PER_BLOCK,true);
+        std::vector<std::vector<uint8_t>> testOut;
+        const auto cb1=[&decoder,k,MAX_LAG](const uint64_t nonce,const uint8_t* payload,const std::size_t payloadSize)mutable {
+            const FECNonce fecNonce=fecNonceFrom(nonce);
+            if(fecNonce.blockIdx==0 && fecNonce.fragmentIdx==1){
+                decoder.validateAndProcessPacket(nonce, std::vector<uint8_t>(payload,payload +payloadSize),1);
+            }
+            if(fecNonce.fragmentIdx==0 || fecNonce.fragmentIdx>=k){
+                return;
+            }
+            decoder.validateAndProcessPacket(nonce, std::vector<uint8_t>(payload,payload +payloadSize),0);
+            if(fecNonce.fragmentIdx==1){
+                const uint64_t expectedLost= fecNonce.blockIdx>MAX_LAG ? fecNonce.blockIdx : 0;
+                assert(decoder.count_blocks_lost==expectedLost);
+            }
+        };
+        const auto cb2=[&testOut](const uint8_t * payload,std::size_t payloadSize)mutable{
+            testOut.emplace_back(payload,payload+payloadSize);
+        };
+        encoder.outputDataCallback=cb1;
+        decoder.mSendDecodedPayloadCallback=cb2;
+        for(const auto& in:testIn){
+            encoder.encodePacket(in.data(),in.size());
+        }
+        assert(decoder.count_blocks_lost==N_BLOCKS-1);
+        assert(testOut.size()==(N_BLOCKS-1)*(k-1));
+        for(int blockIdx=0;blockIdx<N_BLOCKS-1;blockIdx++){
+            for(int i=1;i<k;i++){
+                GenericHelper::assertVectorsEqual(testIn[blockIdx*k+i],testOut[blockIdx*(k-1)+i-1]);
+            }
+        }
+    }
+
+    // drop the first primary fragment of each block and send each fragment twice. In unordered mode,
+    // all other primary fragments must be forwarded immediately, the missing one follows (exactly once) when the block is recovered
+    static void testUnorderedOutput(const int k, const int percentage){
+        // with k==1 there would be nothing to re-order
+        assert(k>1);
+        std::cout<<"Test unordered output. K:"<<k<<" P:"<<percentage<<"\n";
+        constexpr auto N_BLOCKS=3;
+        const auto testIn=GenericHelper::createRandomDataBuffers(N_BLOCKS*k, 1, FEC_MAX_PAYLOAD_SIZE);
+        FECEncoder encoder(k,percentage);
+        FECDecoder decoder(MAX_TOTAL_FRAGMENTS_PER_BLOCK,false,true);
+        std::vector<std::vector<uint8_t>> testOut;
+        const auto cb1=[&decoder](const uint64_t nonce,const uint8_t* payload,const std::size_t payloadSize)mutable {
+            const FECNonce fecNonce=fecNonceFrom(nonce);
+            if(fecNonce.fragmentIdx==0){
+                return;
+            }
+            decoder.validateAndProcessPacket(nonce, std::vector<uint8_t>(payload,payload +payloadSize));
+            decoder.validateAndProcessPacket(nonce, std::vector<uint8_t>(payload,payload +payloadSize));
+        };
+        const auto cb2=[&testOut](const uint8_t * payload,std::size_t payloadSize)mutable{
+            testOut.emplace_back(payload,payload+payloadSize);
+        };
+        encoder.outputDataCallback=cb1;
+        decoder.mSendDecodedPayloadCallback=cb2;
+        for(int i=0;i<testIn.size();i++){
+            encoder.encodePacket(testIn[i].data(),testIn[i].size());
+            const int blockIdx=i/k;
+            const int fragmentIdx=i%k;
+            // the last primary fragment also triggers the secondary fragments, and with them the recovery of the first primary fragment
+            const int nExpectedForBlock= fragmentIdx==k-1 ? k : fragmentIdx;
+            assert(testOut.size()==blockIdx*k+nExpectedForBlock);
+        }
+        for(int blockIdx=0;blockIdx<N_BLOCKS;blockIdx++){
+            for(int i=1;i<k;i++){
+                GenericHelper::assertVectorsEqual(testIn[blockIdx*k+i],testOut[blockIdx*k+i-1]);
+            }
+            GenericHelper::assertVectorsEqual(testIn[blockIdx*k],testOut[blockIdx*k+k-1]);
+        }
+        assert(decoder.count_blocks_recovered==N_BLOCKS);
+        assert(decoder.count_blocks_lost==0);
+    }
+
+    // Secondary fragments are passed to the decoder still "encrypted" (the fake encryption appends the nonce and a checksum).
+    // Block 0: no loss, no secondary fragment must be decrypted.
+    // Block 1: first primary fragment lost and a forged copy of the first secondary fragment arrives before the authentic one.
+    // Block 2: last primary fragment lost, therefore k is unknown and the first secondary fragment has to be decrypted right away.
+    // Block 3: first two primary fragments and all but the first two secondary fragments lost, and a forged copy of the first secondary fragment
+    // arrives before the authentic one (the block can only be recovered if the authentic copy replaces the forged one).
+    // Then a byte-identical copy of the authentic one arrives, which must be dropped without any decryption.
+    // Only if k>2, since k has to be known from the last primary fragment.
+    static void testLazySecondaryDecryption(const int k, const int percentage){
+        assert(k>1);
+        std::cout<<"Test lazy secondary decryption. K:"<<k<<" P:"<<percentage<<"\n";
+        const bool withBlock3=k>2;
+        const auto N_BLOCKS=withBlock3 ? 4 : 3;
+        const auto nSecondary=FECEncoder::calculateN(k,percentage)-k;
+        assert(nSecondary>=2);
+        const auto testIn=GenericHelper::createRandomDataBuffers(N_BLOCKS*k, 1, FEC_MAX_PAYLOAD_SIZE);
+        const auto checksum=[](const uint8_t* data,const std::size_t dataLen){
+            uint64_t ret=0;
+            for(std::size_t i=0;i<dataLen;i++)ret=ret*31+data[i];
+            return ret;
+        };
+        const auto fakeEncrypt=[&checksum](const uint64_t nonce,const uint8_t* payload,const std::size_t payloadSize){
+            std::vector<uint8_t> ret(payload,payload+payloadSize);
+            const uint64_t tag=checksum(payload,payloadSize);
+            ret.insert(ret.end(),(const uint8_t*)&nonce,(const uint8_t*)&nonce+sizeof(nonce));
+            ret.insert(ret.end(),(const uint8_t*)&tag,(const uint8_t*)&tag+sizeof(tag));
+            return ret;
+        };
+        const auto fakeDecrypt=[&checksum](const uint64_t nonce,uint8_t* data,const std::size_t dataLen)->std::optional<std::size_t>{
+            if(dataLen<16)return std::nullopt;
+            const std::size_t payloadSize=dataLen-16;
+            if(memcmp(data+payloadSize,&nonce,sizeof(nonce))!=0)return std::nullopt;
+            const uint64_t tag=checksum(data,payloadSize);
+            if(memcmp(data+payloadSize+8,&tag,sizeof(tag))!=0)return std::nullopt;
+            return payloadSize;
+        };
+        FECEncoder encoder(k,percentage);
+        FECDecoder decoder;
+        std::vector<std::pair<uint64_t,std::vector<uint8_t>>> fragments;
+        encoder.outputDataCallback=[&fragments](const uint64_t nonce,const uint8_t* payload,const std::size_t payloadSize)mutable {
+            fragments.emplace_back(nonce,std::vector<uint8_t>(payload,payload+payloadSize));
+        };
+        std::vector<std::vector<uint8_t>> testOut;
+        decoder.mSendDecodedPayloadCallback=[&testOut](const uint8_t * payload,std::size_t payloadSize)mutable{
+            testOut.emplace_back(payload,payload+payloadSize);
+        };
+        int nDecrypted=0;
+        decoder.mDecryptFragmentCallback=[&fakeDecrypt,&nDecrypted](const uint64_t nonce,uint8_t* data,const std::size_t dataLen){
+            nDecrypted++;
+            return fakeDecrypt(nonce,data,dataLen);
+        };
+        const auto processSecondary=[&](const uint64_t nonce,std::vector<uint8_t> encrypted){
+            if(decoder.processEncryptedSecondaryFragment(nonce,encrypted.data(),encrypted.size()))return;
+            // the decoder needs it decrypted right away
+            nDecrypted++;
+            const auto decryptedSize=fakeDecrypt(nonce,encrypted.data(),encrypted.size());
+            if(decryptedSize==std::nullopt)return;
+            encrypted.resize(*decryptedSize);
+            decoder.validateAndProcessPacket(nonce,encrypted);
+        };
+        for(const auto& in:testIn){
+            encoder.encodePacket(in.data(),in.size());
+        }
+        assert(fragments.size()==N_BLOCKS*(k+nSecondary));
+        for(const auto& [nonce,payload]:fragments){
+            const FECNonce fecNonce=fecNonceFrom(nonce);
+            if(fecNonce.flag==0){
+                if((fecNonce.blockIdx==1 && fecNonce.fragmentIdx==0) || (fecNonce.blockIdx==2 && fecNonce.fragmentIdx==k-1) ||
+                   (fecNonce.blockIdx==3 && fecNonce.fragmentIdx<2)){
+                    continue;
+                }
+                decoder.validateAndProcessPacket(nonce,payload);
+                continue;
+            }
+            if(fecNonce.blockIdx==3 && fecNonce.fragmentIdx>k+1){
+                continue;
+            }
+            auto encrypted=fakeEncrypt(nonce,payload.data(),payload.size());
+            if((fecNonce.blockIdx==1 || fecNonce.blockIdx==3) && fecNonce.fragmentIdx==k){
+                auto forged=encrypted;
+                forged[0]^=1;
+                processSecondary(nonce,forged);
+            }
+            processSecondary(nonce,encrypted);
+            if(fecNonce.blockIdx==3 && fecNonce.fragmentIdx==k){
+                const auto nDecryptedBefore=nDecrypted;
+                processSecondary(nonce,encrypted);
+                assert(nDecrypted==nDecryptedBefore);
+            }
+        }
+        assert(testOut.size()==testIn.size());
+        for(int i=0;i<testIn.size();i++){
+            GenericHelper::assertVectorsEqual(testIn[i],testOut[i]);
+        }
+        assert(decoder.count_blocks_lost==0);
+        assert(decoder.count_blocks_recovered==(withBlock3 ? 3 : 2));
+        assert(decoder.count_secondary_decrypt_failed==(withBlock3 ? 2 : 1));
+        // block 1 needs the forged and the authentic first secondary fragment, block 2 the first secondary fragment,
+        // block 3 the forged and the authentic first and the second secondary fragment
+        assert(nDecrypted==(withBlock3 ? 6 : 3));
+        // block 3 only skips the identical copy
+        assert(decoder.count_secondary_decrypt_skipped==3*nSecondary-2+(withBlock3 ? 1 : 0));
+    }
+
+    // Every fragment is received on 4 rx cards (the slowest card lags one block behind). Only the first copy of each
+    // fragment has to be decrypted, and once a block is done all its secondary fragments are dropped before decryption, too.
+    static void testDropAuthenticatedDuplicates(const int k, const int percentage){
+        std::cout<<"Test drop authenticated duplicates. K:"<<k<<" P:"<<percentage<<"\n";
+        constexpr auto N_BLOCKS=10;
+        constexpr auto N_RX_CARDS=4;
+        const auto testIn=GenericHelper::createRandomDataBuffers(N_BLOCKS*k, 1, FEC_MAX_PAYLOAD_SIZE);
+        FECEncoder encoder(k,percentage);
+        FECDecoder decoder(MAX_TOTAL_FRAGMENTS_PER_BLOCK,true);
+        std::vector<std::pair<uint64_t,std::vector<uint8_t>>> fragments;
+        encoder.outputDataCallback=[&fragments](const uint64_t nonce,const uint8_t* payload,const std::size_t payloadSize)mutable {
+            fragments.emplace_back(nonce,std::vector<uint8_t>(payload,payload+payloadSize));
+        };
+        std::vector<std::vector<uint8_t>> testOut;
+        decoder.mSendDecodedPayloadCallback=[&testOut](const uint8_t * payload,std::size_t payloadSize)mutable{
+            testOut.emplace_back(payload,payload+payloadSize);
+        };
+        for(const auto& in:testIn){
+            encoder.encodePacket(in.data(),in.size());
+        }
+        const int n=FECEncoder::calculateN(k,percentage);
+        int nDecrypted=0;
+        const auto receive=[&](const int fragmentIdx,const int rxCardIdx){
+            const auto& fragment=fragments.at(fragmentIdx);
+            if(decoder.dropAuthenticatedDuplicate(fragment.first,rxCardIdx))return;
+            nDecrypted++;
+            decoder.validateAndProcessPacket(fragment.first,fragment.second,rxCardIdx);
+        };
+        for(int i=0;i<fragments.size()+n;i++){
+            for(int rxCardIdx=0;rxCardIdx<N_RX_CARDS-1;rxCardIdx++){
+                if(i<fragments.size())receive(i,rxCardIdx);
+            }
+            if(i>=n)receive(i-n,N_RX_CARDS-1);
+        }
+        assert(nDecrypted==N_BLOCKS*k);
+        assert(decoder.count_duplicates_dropped_before_decryption==fragments.size()*N_RX_CARDS-N_BLOCKS*k);
+        assert(decoder.count_blocks_lost==0);
+        assert(testOut.size()==testIn.size());
+        for(int i=0;i<testIn.size();i++){
+            GenericHelper::assertVectorsEqual(testIn[i],testOut[i]);
+        }
+        // a fragment that has never been received is never dropped
+        const auto nextNonce=(uint64_t)FECNonce{N_BLOCKS,0,0,0};
+        assert(!decoder.dropAuthenticatedDuplicate(nextNonce,0));
+    }
+
     // No packet loss
     // Fixed packet size
     static void testWithoutPacketLossFixedPacketSize(const int k,const int percentage, const std::size_t N_PACKETS){
@@ -243,18 +766,32 @@ namespace TestFEC{
 }
 
 namespace TestEncryption{
-    static void test(const bool useGeneratedFiles){
-        std::cout<<"Using generated keypair (default seed otherwise):"<<(useGeneratedFiles ? "y":"n")<<"\n";
+    static void test(const bool useGeneratedFiles,const Cipher cipher=Cipher::CHACHA20_POLY1305){
+        std::cout<<"Using generated keypair (default seed otherwise):"<<(useGeneratedFiles ? "y":"n")<<" cipher:"<<(int)cipher<<"\n";
         std::optional<std::string> encKey=useGeneratedFiles ?  std::optional<std::string>("gs.key") : std::nullopt;
         std::optional<std::string> decKey=useGeneratedFiles ?  std::optional<std::string>("drone.key") : std::nullopt;
 
-        Encryptor encryptor{encKey};
+        Encryptor encryptor{encKey,false,EncryptionMode::ENCRYPT_AND_AUTHENTICATE,cipher};
         Decryptor decryptor{decKey};
         WBSessionKeyPacket sessionKeyPacket;
         // make session key (tx)
         encryptor.makeNewSessionKey(sessionKeyPacket.sessionKeyNonce, sessionKeyPacket.sessionKeyData);
         // and "receive" session key (rx)
         assert(decryptor.onNewPacketSessionKeyData(sessionKeyPacket.sessionKeyNonce, sessionKeyPacket.sessionKeyData) == true);
+        assert(decryptor.getCipher()==encryptor.getCipher());
+        // the same session key packet again is skipped
+        assert(decryptor.onNewPacketSessionKeyData(sessionKeyPacket.sessionKeyNonce, sessionKeyPacket.sessionKeyData) == false);
+        assert(decryptor.count_session_key_packets_unchanged==1);
+        // a session key rollover (the new key has been prepared in the background)
+        const auto oldSessionKeyData=sessionKeyPacket.sessionKeyData;
+        encryptor.makeNewSessionKey(sessionKeyPacket.sessionKeyNonce, sessionKeyPacket.sessionKeyData);
+        assert(oldSessionKeyData!=sessionKeyPacket.sessionKeyData);
+        assert(decryptor.onNewPacketSessionKeyData(sessionKeyPacket.sessionKeyNonce, sessionKeyPacket.sessionKeyData) == true);
+        // a modified session key packet is not skipped, but rejected
+        auto forgedSessionKeyData=sessionKeyPacket.sessionKeyData;
+        forgedSessionKeyData[0]^=1;
+        assert(decryptor.onNewPacketSessionKeyData(sessionKeyPacket.sessionKeyNonce, forgedSessionKeyData) == false);
+        assert(decryptor.count_session_key_packets_unchanged==1);
         // now encrypt a couple of packets and decrypt them again afterwards
         for(uint64_t nonce=0; nonce < 20; nonce++){
             const auto data=GenericHelper::createRandomDataBuffer(FEC_MAX_PAYLOAD_SIZE);
@@ -263,11 +800,482 @@ namespace TestEncryption{
             const auto decrypted=decryptor.decryptPacket(wbDataHeader.nonce,encrypted.data(), encrypted.size(),wbDataHeader);
             assert(decrypted!=std::nullopt);
             assert(GenericHelper::compareVectors(data,*decrypted) == true);
+            // same, but in place in a caller-provided buffer
+            std::vector<uint8_t> buffer(data.size()+crypto_aead_chacha20poly1305_ABYTES);
+            memcpy(buffer.data(),data.data(),data.size());
+            const auto encryptedSize=encryptor.encryptPacket(wbDataHeader.nonce,buffer.data(),data.size(),wbDataHeader,buffer.data());
+            assert(encryptedSize==encrypted.size());
+            assert(GenericHelper::compareVectors(encrypted,buffer) == true);
+            const auto decryptedSize=decryptor.decryptPacket(wbDataHeader.nonce,buffer.data(),encryptedSize,wbDataHeader,buffer.data());
+            assert(decryptedSize!=std::nullopt && *decryptedSize==data.size());
+            buffer.resize(*decryptedSize);
+            assert(GenericHelper::compareVectors(data,buffer) == true);
         }
         std::cout<<"encryption test passed\n";
     }
+    // the payload is sent in plain text, but the rx must still reject anything that has been tampered with
+    static void testAuthenticateOnly(){
+        std::cout<<"Test authenticate only\n";
+        Encryptor encryptor{std::nullopt,false,EncryptionMode::AUTHENTICATE_ONLY};
+        Decryptor decryptor{std::nullopt};
+        WBSessionKeyPacket sessionKeyPacket;
+        encryptor.makeNewSessionKey(sessionKeyPacket.sessionKeyNonce, sessionKeyPacket.sessionKeyData);
+        assert(decryptor.onNewPacketSessionKeyData(sessionKeyPacket.sessionKeyNonce, sessionKeyPacket.sessionKeyData) == true);
+        assert(decryptor.getEncryptionMode()==EncryptionMode::AUTHENTICATE_ONLY);
+        for(uint64_t nonce=0; nonce < 20; nonce++){
+            const auto data=GenericHelper::createRandomDataBuffer(FEC_MAX_PAYLOAD_SIZE);
+            const WBDataHeader wbDataHeader(nonce);
+            const auto authenticated=encryptor.encryptPacket(wbDataHeader.nonce,data.data(),data.size(),wbDataHeader);
+            assert(authenticated.size()==data.size()+crypto_aead_chacha20poly1305_ABYTES);
+            assert(memcmp(authenticated.data(),data.data(),data.size())==0);
+            const auto validated=decryptor.decryptPacket(wbDataHeader.nonce,authenticated.data(), authenticated.size(),wbDataHeader);
+            assert(validated!=std::nullopt);
+            assert(GenericHelper::compareVectors(data,*validated) == true);
+            // modified payload
+            auto tampered=authenticated;
+            tampered[nonce]^=1;
+            assert(decryptor.decryptPacket(wbDataHeader.nonce,tampered.data(), tampered.size(),wbDataHeader)==std::nullopt);
+            // modified header
+            const WBDataHeader otherHeader(nonce+1);
+            assert(decryptor.decryptPacket(otherHeader.nonce,authenticated.data(), authenticated.size(),otherHeader)==std::nullopt);
+        }
+        std::cout<<"authenticate only test passed\n";
+    }
+    // Re-box the session key of @param sessionKeyPacket (default keys) with a new nonce after applying @param modify,
+    // as a tx announcing the same session key with different parameters would do
+    static void reboxSessionKey(WBSessionKeyPacket& sessionKeyPacket,const std::function<void(SessionKeyPlaintext&)>& modify){
+        std::array<uint8_t,crypto_box_PUBLICKEYBYTES> publicKey{};
+        std::array<uint8_t,crypto_box_SECRETKEYBYTES> secretKey{};
+        crypto_box_seed_keypair(publicKey.data(),secretKey.data(),DEFAULT_ENCRYPTION_SEED.data());
+        std::array<uint8_t,crypto_box_BEFORENMBYTES> boxKey{};
+        assert(crypto_box_beforenm(boxKey.data(),publicKey.data(),secretKey.data())==0);
+        SessionKeyPlaintext plaintext{};
+        assert(crypto_box_open_easy_afternm((uint8_t*)&plaintext,sessionKeyPacket.sessionKeyData.data(),sessionKeyPacket.sessionKeyData.size(),
+                                            sessionKeyPacket.sessionKeyNonce.data(),boxKey.data())==0);
+        modify(plaintext);
+        randombytes_buf(sessionKeyPacket.sessionKeyNonce.data(),sessionKeyPacket.sessionKeyNonce.size());
+        assert(crypto_box_easy_afternm(sessionKeyPacket.sessionKeyData.data(),(const uint8_t*)&plaintext,sizeof(plaintext),
+                                       sessionKeyPacket.sessionKeyNonce.data(),boxKey.data())==0);
+    }
+    // The encryption mode is boxed together with the session key - it can neither be forged by modifying (or replaying)
+    // a session key packet, nor does the rx miss a change of the mode by the tx.
+    static void testAuthenticatedEncryptionMode(){
+        std::cout<<"Test authenticated encryption mode\n";
+        Encryptor encryptor{std::nullopt,false,EncryptionMode::ENCRYPT_AND_AUTHENTICATE};
+        Decryptor decryptor{std::nullopt};
+        WBSessionKeyPacket sessionKeyPacket;
+        encryptor.makeNewSessionKey(sessionKeyPacket.sessionKeyNonce, sessionKeyPacket.sessionKeyData);
+        // the mode byte of a genuine session key packet flipped, as an attacker would do to make the rx accept plain text data
+        auto forgedSessionKeyData=sessionKeyPacket.sessionKeyData;
+        forgedSessionKeyData[crypto_box_MACBYTES+offsetof(SessionKeyPlaintext,encryptionMode)]^=(uint8_t)EncryptionMode::AUTHENTICATE_ONLY;
+        assert(decryptor.onNewPacketSessionKeyData(sessionKeyPacket.sessionKeyNonce, forgedSessionKeyData) == false);
+        assert(decryptor.onNewPacketSessionKeyData(sessionKeyPacket.sessionKeyNonce, sessionKeyPacket.sessionKeyData) == true);
+        assert(decryptor.getEncryptionMode()==EncryptionMode::ENCRYPT_AND_AUTHENTICATE);
+        // replayed afterwards, the forged packet is still rejected (and not mistaken for the unchanged session key packet)
+        assert(decryptor.onNewPacketSessionKeyData(sessionKeyPacket.sessionKeyNonce, forgedSessionKeyData) == false);
+        assert(decryptor.getEncryptionMode()==EncryptionMode::ENCRYPT_AND_AUTHENTICATE);
+        assert(decryptor.count_session_key_packets_unchanged==0);
+        // the tx announces the same session key with a different mode - the rx has to apply it
+        reboxSessionKey(sessionKeyPacket,[](SessionKeyPlaintext& plaintext){
+            plaintext.encryptionMode=(uint8_t)EncryptionMode::AUTHENTICATE_ONLY;
+        });
+        assert(decryptor.onNewPacketSessionKeyData(sessionKeyPacket.sessionKeyNonce, sessionKeyPacket.sessionKeyData) == true);
+        assert(decryptor.getEncryptionMode()==EncryptionMode::AUTHENTICATE_ONLY);
+        // and data the (encrypting) tx sent with that key is rejected, since the rx now expects plain text
+        const auto data=GenericHelper::createRandomDataBuffer(FEC_MAX_PAYLOAD_SIZE);
+        const WBDataHeader wbDataHeader(0);
+        const auto encrypted=encryptor.encryptPacket(wbDataHeader.nonce,data.data(),data.size(),wbDataHeader);
+        assert(decryptor.decryptPacket(wbDataHeader.nonce,encrypted.data(), encrypted.size(),wbDataHeader)==std::nullopt);
+        std::cout<<"authenticated encryption mode test passed\n";
+    }
+    // Same for the cipher - and the rx must not keep using the expanded AES key of a previous session
+    static void testAuthenticatedCipher(){
+        std::cout<<"Test authenticated cipher\n";
+        Encryptor chachaEncryptor{std::nullopt,false,EncryptionMode::ENCRYPT_AND_AUTHENTICATE,Cipher::CHACHA20_POLY1305};
+        Encryptor aesEncryptor{std::nullopt,false,EncryptionMode::ENCRYPT_AND_AUTHENTICATE,Cipher::AES256GCM};
+        Decryptor decryptor{std::nullopt};
+        const auto data=GenericHelper::createRandomDataBuffer(FEC_MAX_PAYLOAD_SIZE);
+        const WBDataHeader wbDataHeader(0);
+        WBSessionKeyPacket sessionKeyPacket;
+        chachaEncryptor.makeNewSessionKey(sessionKeyPacket.sessionKeyNonce, sessionKeyPacket.sessionKeyData);
+        auto forgedSessionKeyData=sessionKeyPacket.sessionKeyData;
+        forgedSessionKeyData[crypto_box_MACBYTES+offsetof(SessionKeyPlaintext,cipher)]^=(uint8_t)Cipher::AES256GCM;
+        assert(decryptor.onNewPacketSessionKeyData(sessionKeyPacket.sessionKeyNonce, forgedSessionKeyData) == false);
+        assert(decryptor.onNewPacketSessionKeyData(sessionKeyPacket.sessionKeyNonce, sessionKeyPacket.sessionKeyData) == true);
+        assert(decryptor.getCipher()==Cipher::CHACHA20_POLY1305);
+        // a new session that switches to AES256GCM
+        aesEncryptor.makeNewSessionKey(sessionKeyPacket.sessionKeyNonce, sessionKeyPacket.sessionKeyData);
+        assert(decryptor.onNewPacketSessionKeyData(sessionKeyPacket.sessionKeyNonce, sessionKeyPacket.sessionKeyData) == true);
+        assert(decryptor.getCipher()==Cipher::AES256GCM);
+        const auto encrypted=aesEncryptor.encryptPacket(wbDataHeader.nonce,data.data(),data.size(),wbDataHeader);
+        const auto decrypted=decryptor.decryptPacket(wbDataHeader.nonce,encrypted.data(), encrypted.size(),wbDataHeader);
+        assert(decrypted!=std::nullopt && GenericHelper::compareVectors(data,*decrypted));
+        // the same session key, but back to CHACHA20_POLY1305 - the rx has to apply it
+        reboxSessionKey(sessionKeyPacket,[](SessionKeyPlaintext& plaintext){
+            plaintext.cipher=(uint8_t)Cipher::CHACHA20_POLY1305;
+        });
+        assert(decryptor.onNewPacketSessionKeyData(sessionKeyPacket.sessionKeyNonce, sessionKeyPacket.sessionKeyData) == true);
+        assert(decryptor.getCipher()==Cipher::CHACHA20_POLY1305);
+        assert(decryptor.decryptPacket(wbDataHeader.nonce,encrypted.data(), encrypted.size(),wbDataHeader)==std::nullopt);
+        // and to AES256GCM again, with the expanded AES key re-calculated from the session key
+        reboxSessionKey(sessionKeyPacket,[](SessionKeyPlaintext& plaintext){
+            plaintext.cipher=(uint8_t)Cipher::AES256GCM;
+        });
+        assert(decryptor.onNewPacketSessionKeyData(sessionKeyPacket.sessionKeyNonce, sessionKeyPacket.sessionKeyData) == true);
+        const auto decrypted2=decryptor.decryptPacket(wbDataHeader.nonce,encrypted.data(), encrypted.size(),wbDataHeader);
+        assert(decrypted2!=std::nullopt && GenericHelper::compareVectors(data,*decrypted2));
+        std::cout<<"authenticated cipher test passed\n";
+    }
 }
 
+namespace TestTx{
+    static void assertAirtimeUs(const RadiotapHeader::UserSelectableParams& params,const std::size_t frameSize,const double expectedUs){
+        const auto airtime=Airtime::calculateAirtime(params,frameSize);
+        // the calculation is done in (fractional) us
+        assert(std::abs(airtime.count()-(int64_t)(expectedUs*1000.0))<=1);
+    }
+    // known airtimes, calculated by hand. 101.5us medium access, 32us preamble, 4us per HT-LTF,
+    // n of symbols for SERVICE (16) + (frame+FCS)*8 + tail (6) bits
+    static void testAirtime(){
+        std::cout<<"Test airtime\n";
+        RadiotapHeader::UserSelectableParams params{};
+        params.bandwidth=20;
+        params.mcs_index=0;
+        // 854 bits, 26 per symbol -> 33 symbols a 4us
+        assertAirtimeUs(params,100,101.5+32+4+33*4.0);
+        params.mcs_index=7;
+        params.bandwidth=40;
+        params.short_gi=true;
+        // 12054 bits, 540 per symbol -> 23 symbols a 3.6us
+        assertAirtimeUs(params,1500,101.5+32+4+23*3.6);
+        // MCS index >7 (more than one spatial stream) is treated as MCS 7
+        params.mcs_index=9;
+        assertAirtimeUs(params,1500,101.5+32+4+23*3.6);
+        params.mcs_index=1;
+        params.bandwidth=20;
+        params.short_gi=false;
+        params.stbc=1;
+        // 854 bits, 52 per symbol -> 17 symbols, rounded up to an even number with STBC, one more HT-LTF
+        assertAirtimeUs(params,100,101.5+32+2*4+18*4.0);
+        params.stbc=0;
+        assertAirtimeUs(params,100,101.5+32+4+17*4.0);
+    }
+    static void testAirtimePacer(){
+        std::cout<<"Test airtime pacer\n";
+        RadiotapHeader::UserSelectableParams params{};
+        params.mcs_index=0;
+        constexpr auto FRAME_SIZE=100;
+        const int64_t frameNs=Airtime::calculateAirtime(params,FRAME_SIZE).count();
+        assert(frameNs==269500);
+        constexpr auto AIRTIME_SHARE=0.5;
+        AirtimePacer pacer(params,AIRTIME_SHARE,std::chrono::milliseconds(1));
+        const auto t0=std::chrono::steady_clock::now();
+        // the bucket starts full, 3 frames fit into the burst
+        const int64_t nBurst=std::chrono::nanoseconds(std::chrono::milliseconds(1)).count()/frameNs;
+        assert(nBurst==3);
+        for(int i=0;i<nBurst;i++){
+            assert(pacer.reserve(FRAME_SIZE,t0).count()==0);
+        }
+        // the 4th frame has to wait until the debt is paid back, at half the real time since only half of the airtime is ours
+        const int64_t debtNs=frameNs*(nBurst+1)-std::chrono::nanoseconds(std::chrono::milliseconds(1)).count();
+        const auto wait=pacer.reserve(FRAME_SIZE,t0);
+        assert(wait.count()==(int64_t)(debtNs/AIRTIME_SHARE));
+        // after waiting the bucket is empty, the next frame has to wait for its whole airtime
+        assert(pacer.reserve(FRAME_SIZE,t0+wait).count()==(int64_t)(frameNs/AIRTIME_SHARE));
+        // other params for this frame only (MCS 7 is much faster, but the debt is still there)
+        RadiotapHeader::UserSelectableParams fastParams=params;
+        fastParams.mcs_index=7;
+        const auto t1=t0+wait+std::chrono::nanoseconds((int64_t)(frameNs/AIRTIME_SHARE));
+        assert(pacer.reserve(FRAME_SIZE,t1,fastParams).count()==(int64_t)(Airtime::calculateAirtime(fastParams,FRAME_SIZE).count()/AIRTIME_SHARE));
+        // after a long pause the bucket is full again, but never holds more than the max burst
+        const auto t2=t1+std::chrono::seconds(1);
+        for(int i=0;i<nBurst;i++){
+            assert(pacer.reserve(FRAME_SIZE,t2).count()==0);
+        }
+        assert(pacer.reserve(FRAME_SIZE,t2).count()==(int64_t)(debtNs/AIRTIME_SHARE));
+    }
+    // RTP header (all zero) followed by the given NAL unit header bytes
+    static std::vector<uint8_t> createRtpPacket(const std::vector<uint8_t>& naluHeader){
+        std::vector<uint8_t> ret(RTPLockup::RTP_HEADER_SIZE+naluHeader.size(),0);
+        std::copy(naluHeader.begin(),naluHeader.end(),ret.begin()+RTPLockup::RTP_HEADER_SIZE);
+        return ret;
+    }
+    static void testNonReferenceNalus(){
+        std::cout<<"Test non reference NALUs\n";
+        const auto isH264NonRef=[](const std::vector<uint8_t>& naluHeader){
+            const auto packet=createRtpPacket(naluHeader);
+            return RTPLockup::h264_is_non_reference(packet.data(),packet.size());
+        };
+        // h264: F(1) NRI(2) type(5)
+        // non-IDR slice with nal_ref_idc==0 / !=0
+        assert(isH264NonRef({0x01}));
+        assert(!isH264NonRef({0x41}));
+        // IDR slice
+        assert(!isH264NonRef({0x65}));
+        // FU-A, the nal_ref_idc of the original NALU is in the FU indicator
+        assert(isH264NonRef({0x1C,0x81}));
+        assert(!isH264NonRef({0x7C,0x85}));
+        // STAP-A is never classified as non reference
+        assert(!isH264NonRef({0x18}));
+        const auto isH265NonRef=[](const std::vector<uint8_t>& naluHeader){
+            const auto packet=createRtpPacket(naluHeader);
+            return RTPLockup::h265_is_non_reference(packet.data(),packet.size());
+        };
+        // h265: F(1) type(6) layerId(6) tid(3)
+        const auto h265Header=[](const uint8_t type)->std::vector<uint8_t>{
+            return {(uint8_t)(type<<1),1};
+        };
+        // TRAIL_N / TRAIL_R
+        assert(isH265NonRef(h265Header(0)));
+        assert(!isH265NonRef(h265Header(1)));
+        // TSA_N, STSA_N, RADL_N, RASL_N
+        for(const uint8_t type:{2,4,6,8}){
+            assert(isH265NonRef(h265Header(type)));
+        }
+        // RASL_R, IDR_W_RADL, CRA, VPS
+        for(const uint8_t type:{9,19,21,32}){
+            assert(!isH265NonRef(h265Header(type)));
+        }
+        // fragmentation unit (49), the type of the original NALU is in the FU header: S(1) E(1) type(6)
+        auto fu=h265Header(49);
+        fu.push_back(0x80);
+        assert(isH265NonRef(fu));
+        fu.back()=0x81;
+        assert(!isH265NonRef(fu));
+        // too short to tell
+        assert(!isH265NonRef(h265Header(49)));
+        assert(!RTPLockup::h264_is_non_reference(fu.data(),RTPLockup::RTP_HEADER_SIZE));
+    }
+    // Records the first byte of each injected packet. Injecting the first packet blocks until released,
+    // such that the packets queued in the meantime become stale.
+    class BlockingInjector : public IRawPacketInjector{
+    public:
+        std::chrono::steady_clock::duration injectPacket(const RadiotapHeader&,const Ieee80211Header&,const AbstractWBPacket&)const{
+            return std::chrono::steady_clock::duration(0);
+        }
+        std::chrono::steady_clock::duration injectPacket(const RadiotapIeee80211Template&,const AbstractWBPacket&)const{
+            return std::chrono::steady_clock::duration(0);
+        }
+        std::chrono::steady_clock::duration injectPacket(const uint8_t* packet,std::size_t packetSize)const{
+            isBlocked=true;
+            while(!released){
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            }
+            std::lock_guard<std::mutex> lock(mMutex);
+            injected.push_back(packet[0]);
+            return std::chrono::steady_clock::duration(0);
+        }
+        std::vector<uint8_t> getInjected()const{
+            std::lock_guard<std::mutex> lock(mMutex);
+            return injected;
+        }
+        mutable std::atomic<bool> isBlocked{false};
+        std::atomic<bool> released{false};
+    private:
+        mutable std::mutex mMutex;
+        mutable std::vector<uint8_t> injected;
+    };
+    // Groups (e.g. FEC blocks) whose first packet has been queued for longer than the max latency are dropped as a whole,
+    // low priority groups already after half of it. Groups that have been started are always injected completely.
+    // Uses a fake clock, such that the result doesn't depend on how fast the injection thread is scheduled.
+    static void testThreadedInjectorDropsStaleGroups(){
+        std::cout<<"Test threaded injector drops stale groups\n";
+        constexpr auto MAX_LATENCY=std::chrono::milliseconds(200);
+        auto blockingInjector=std::make_unique<BlockingInjector>();
+        BlockingInjector& fake=*blockingInjector;
+        std::atomic<int64_t> fakeNowNs{0};
+        const auto advanceClock=[&fakeNowNs](const std::chrono::nanoseconds delta){
+            fakeNowNs.fetch_add(delta.count());
+        };
+        ThreadedInjector injector(std::move(blockingInjector),16,MAX_LATENCY,1,[&fakeNowNs]{
+            return std::chrono::steady_clock::time_point(std::chrono::nanoseconds(fakeNowNs.load()));
+        });
+        const auto queue=[&injector](const uint8_t id){
+            const std::array<uint8_t,4> packet{id,0,0,0};
+            injector.queuePacket(packet.data(),packet.size());
+        };
+        injector.setGroup(1);
+        queue(11);
+        injector.flush();
+        while(!fake.isBlocked){
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        queue(12);
+        injector.setGroup(2);
+        queue(21);
+        queue(22);
+        queue(23);
+        advanceClock(MAX_LATENCY+std::chrono::milliseconds(50));
+        injector.setGroup(3,true);
+        queue(31);
+        injector.setGroup(4);
+        queue(41);
+        // older than half the max latency, but younger than the max latency
+        advanceClock(MAX_LATENCY/2+std::chrono::milliseconds(30));
+        fake.released=true;
+        injector.flush();
+        const auto deadline=std::chrono::steady_clock::now()+std::chrono::seconds(10);
+        while(injector.getNInjectedPackets()+injector.getNDroppedStalePackets()<7 && std::chrono::steady_clock::now()<deadline){
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        // group 1 has been started already, group 2 is too old and group 3 is low priority
+        assert((fake.getInjected()==std::vector<uint8_t>{11,12,41}));
+        assert(injector.getNDroppedGroups()==2);
+        assert(injector.getNDroppedStalePackets()==4);
+        assert(injector.getNDroppedPackets()==0);
+    }
+    // Records what the MultiCardInjector does with each card (all cards write into the same log, in call order).
+    // Each packet is identified by its first byte.
+    class RecordingInjector : public IRawPacketInjector{
+    public:
+        struct Event{
+            std::size_t cardIdx;
+            char type; // 'q' queuePacket, 'i' injectPacket, 'f' flush
+            uint8_t packetId;
+            bool operator==(const Event& other)const{
+                return cardIdx==other.cardIdx && type==other.type && packetId==other.packetId;
+            }
+        };
+        RecordingInjector(std::vector<Event>& log,const std::size_t cardIdx):log(log),cardIdx(cardIdx){}
+        std::chrono::steady_clock::duration injectPacket(const RadiotapHeader&,const Ieee80211Header&,const AbstractWBPacket&)const{
+            return std::chrono::steady_clock::duration(0);
+        }
+        std::chrono::steady_clock::duration injectPacket(const RadiotapIeee80211Template&,const AbstractWBPacket&)const{
+            return std::chrono::steady_clock::duration(0);
+        }
+        std::chrono::steady_clock::duration injectPacket(const uint8_t* packet,std::size_t packetSize)const{
+            log.push_back({cardIdx,'i',packet[0]});
+            return std::chrono::steady_clock::duration(0);
+        }
+        void queuePacket(const uint8_t* packet,std::size_t packetSize)const{
+            log.push_back({cardIdx,'q',packet[0]});
+        }
+        std::chrono::steady_clock::duration flush()const{
+            log.push_back({cardIdx,'f',0});
+            return std::chrono::steady_clock::duration(0);
+        }
+    private:
+        std::vector<Event>& log;
+        const std::size_t cardIdx;
+    };
+    static std::unique_ptr<MultiCardInjector> createRecordingMultiCardInjector(std::vector<RecordingInjector::Event>& log,const std::size_t nCards,
+                                                                               const MultiCardInjector::Mode mode){
+        std::vector<std::unique_ptr<IRawPacketInjector>> cards;
+        for(std::size_t i=0;i<nCards;i++){
+            cards.push_back(std::make_unique<RecordingInjector>(log,i));
+        }
+        return std::make_unique<MultiCardInjector>(std::move(cards),mode);
+    }
+    // DUPLICATE queues each packet on every card, STRIPE round-robin. injectPacket() always goes to all cards,
+    // but only after what is already queued has been flushed.
+    static void testMultiCardInjector(){
+        std::cout<<"Test multi card injector\n";
+        using Event=RecordingInjector::Event;
+        const auto queue=[](MultiCardInjector& injector,const uint8_t id){
+            const std::array<uint8_t,4> packet{id,0,0,0};
+            injector.queuePacket(packet.data(),packet.size());
+        };
+        const auto inject=[](MultiCardInjector& injector,const uint8_t id){
+            const std::array<uint8_t,4> packet{id,0,0,0};
+            injector.injectPacket(packet.data(),packet.size());
+        };
+        {
+            std::vector<Event> log;
+            auto injector=createRecordingMultiCardInjector(log,3,MultiCardInjector::Mode::DUPLICATE);
+            queue(*injector,1);
+            queue(*injector,2);
+            injector->flush();
+            assert((log==std::vector<Event>{{0,'q',1},{1,'q',1},{2,'q',1},{0,'q',2},{1,'q',2},{2,'q',2},{0,'f',0},{1,'f',0},{2,'f',0}}));
+            for(std::size_t i=0;i<3;i++){
+                assert(injector->getNInjectedPackets(i)==2);
+            }
+            // nothing queued, nothing to flush
+            log.clear();
+            inject(*injector,9);
+            assert((log==std::vector<Event>{{0,'i',9},{1,'i',9},{2,'i',9}}));
+            for(std::size_t i=0;i<3;i++){
+                assert(injector->getNInjectedPackets(i)==3);
+            }
+        }
+        {
+            std::vector<Event> log;
+            auto injector=createRecordingMultiCardInjector(log,3,MultiCardInjector::Mode::STRIPE);
+            for(uint8_t id=1;id<=5;id++){
+                queue(*injector,id);
+            }
+            inject(*injector,9);
+            assert((log==std::vector<Event>{{0,'q',1},{1,'q',2},{2,'q',3},{0,'q',4},{1,'q',5},
+                                            {0,'f',0},{1,'f',0},{2,'f',0},
+                                            {0,'i',9},{1,'i',9},{2,'i',9}}));
+            assert(injector->getNInjectedPackets(0)==3);
+            assert(injector->getNInjectedPackets(1)==3);
+            assert(injector->getNInjectedPackets(2)==2);
+            // the round-robin continues where it stopped, and only the card that has packets queued is flushed
+            log.clear();
+            queue(*injector,6);
+            injector->flush();
+            assert((log==std::vector<Event>{{2,'q',6},{2,'f',0}}));
+            assert(injector->getNInjectedPackets(0)==3);
+            assert(injector->getNInjectedPackets(1)==3);
+            assert(injector->getNInjectedPackets(2)==3);
+        }
+    }
+}
+
+namespace TestRx{
+    // Writes a TPACKET_V3 block the way the kernel does (block descriptor, then the packets each with a tpacket3_hdr in front,
+    // chained via tp_next_offset) and walks it with the same code the RxRingReceiver uses for the mmap'ed ring.
+    static void testRxRingBlockWalk(){
+        std::cout<<"Test rx ring block walk\n";
+        const std::vector<std::vector<uint8_t>> packets={
+                GenericHelper::createRandomDataBuffer(100),
+                GenericHelper::createRandomDataBuffer(1),
+                GenericHelper::createRandomDataBuffer(1510)
+        };
+        // uint64_t for the alignment of the headers
+        std::vector<uint64_t> buffer(4096/sizeof(uint64_t),0);
+        uint8_t* blockStart=(uint8_t*)buffer.data();
+        auto& block=*(tpacket_block_desc*)blockStart;
+        block.version=TPACKET_V3;
+        block.hdr.bh1.num_pkts=packets.size();
+        block.hdr.bh1.offset_to_first_pkt=TPACKET_ALIGN(sizeof(tpacket_block_desc));
+        std::size_t offset=block.hdr.bh1.offset_to_first_pkt;
+        for(std::size_t i=0;i<packets.size();i++){
+            auto& tpHdr=*(tpacket3_hdr*)(blockStart+offset);
+            tpHdr.tp_sec=1000+i;
+            tpHdr.tp_nsec=i*1000*1000+999;
+            tpHdr.tp_snaplen=packets[i].size();
+            // as if the packet had been truncated, except for the first one
+            tpHdr.tp_len=packets[i].size()+(i==0 ? 0 : 10);
+            // the kernel leaves some space between the header and the packet
+            tpHdr.tp_mac=TPACKET_ALIGN(sizeof(tpacket3_hdr))+16;
+            memcpy(blockStart+offset+tpHdr.tp_mac,packets[i].data(),packets[i].size());
+            const std::size_t frameSize=TPACKET_ALIGN(tpHdr.tp_mac+packets[i].size());
+            // the last packet has no next packet
+            tpHdr.tp_next_offset= i+1<packets.size() ? frameSize : 0;
+            offset+=frameSize;
+            assert(offset<=buffer.size()*sizeof(uint64_t));
+        }
+        std::vector<pcap_pkthdr> hdrs;
+        std::vector<std::vector<uint8_t>> walked;
+        const auto nPackets=RxRingReceiver::forEachPacketInBlock(block,[&hdrs,&walked](const pcap_pkthdr& hdr,const uint8_t* pkt){
+            hdrs.push_back(hdr);
+            walked.emplace_back(pkt,pkt+hdr.caplen);
+        });
+        assert(nPackets==packets.size());
+        assert(walked.size()==packets.size());
+        for(std::size_t i=0;i<packets.size();i++){
+            GenericHelper::assertVectorsEqual(packets[i],walked[i]);
+            assert(hdrs[i].ts.tv_sec==1000+(long)i);
+            assert(hdrs[i].ts.tv_usec==(long)(i*1000));
+            assert(hdrs[i].caplen==packets[i].size());
+            assert(hdrs[i].len==packets[i].size()+(i==0 ? 0 : 10));
+        }
+        // an empty block (retired by the timeout without any packets)
+        block.hdr.bh1.num_pkts=0;
+        assert(RxRingReceiver::forEachPacketInBlock(block,[](const pcap_pkthdr&,const uint8_t*){assert(false);})==0);
+    }
+}
 
 int main(int argc, char *argv[]){
     std::cout<<"Tests for Wifibroadcast\n";
@@ -282,7 +1290,7 @@ int main(int argc, char *argv[]){
                 break;
             default: /* '?' */
             show_usage:
-                std::cout<<"Usage: Unit tests for FEC and encryption. -m 0,1,2 test mode: 0==ALL, 1==FEC only 2==Encryption only\n";
+                std::cout<<"Usage: Unit tests for FEC and encryption. -m 0,1,2,3,4 test mode: 0==ALL, 1==FEC only 2==Encryption only 3==TX helpers only 4==RX helpers only\n";
                 return 1;
         }
     }
@@ -296,6 +1304,9 @@ int main(int argc, char *argv[]){
             testFecCPlusPlusWrapperX();
             const int N_PACKETS=1200;
             TestFEC::testNonce();
+            TestFEC::testFragmentBitmap();
+            TestFEC::testFECDisabledDuplicates();
+            TestFEC::testFECDisabledReorderBuffer();
             // With these fec params "testWithoutPacketLoss" is not possible
             const std::vector<std::pair<unsigned int,unsigned int>> fecParams1={
                     {1,0},{1,100},
@@ -325,6 +1336,18 @@ int main(int argc, char *argv[]){
                 TestFEC::testWithoutPacketLossFixedPacketSize(k, p, N_PACKETS);
                 TestFEC::testWithoutPacketLossDynamicPacketSize(k, p, N_PACKETS);
                 TestFEC::testRxQueue(k, p);
+                if(k>1){
+                    TestFEC::testRemoveBlocksOlderThan(k, p);
+                    TestFEC::testEarlyGiveUp(k, p);
+                    TestFEC::testEarlyGiveUpStaleRxCard(k, p);
+                    if(FECEncoder::calculateN(k,p)-k+1<k){
+                        TestFEC::testEarlyGiveUpMidBlock(k, p);
+                    }
+                    TestFEC::testUnorderedOutput(k, p);
+                    TestFEC::testAdaptiveRxQueue(k, p);
+                    TestFEC::testLazySecondaryDecryption(k, p);
+                    TestFEC::testDropAuthenticatedDuplicates(k, p);
+                }
                 for(int dropMode=1;dropMode<2;dropMode++){
                     TestFEC::testWithPacketLossButEverythingIsRecoverable(k, p, N_PACKETS, dropMode);
                 }
@@ -336,8 +1359,29 @@ int main(int argc, char *argv[]){
             std::cout<<"Testing Encryption\n";
             TestEncryption::test(false);
             TestEncryption::test(true);
+            if(isCipherAvailable((uint8_t)Cipher::AES256GCM)){
+                TestEncryption::test(false,Cipher::AES256GCM);
+                TestEncryption::test(true,Cipher::AES256GCM);
+            }
+            TestEncryption::testAuthenticateOnly();
+            TestEncryption::testAuthenticatedEncryptionMode();
+            if(isCipherAvailable((uint8_t)Cipher::AES256GCM)){
+                TestEncryption::testAuthenticatedCipher();
+            }
             //
         }
+        if(test_mode==0 || test_mode==3){
+            std::cout<<"Testing TX helpers\n";
+            TestTx::testAirtime();
+            TestTx::testAirtimePacer();
+            TestTx::testNonReferenceNalus();
+            TestTx::testThreadedInjectorDropsStaleGroups();
+            TestTx::testMultiCardInjector();
+        }
+        if(test_mode==0 || test_mode==4){
+            std::cout<<"Testing RX helpers\n";
+            TestRx::testRxRingBlockWalk();
+        }
     }catch (std::runtime_error &e) {
         std::cerr<<"Error: "<<std::string(e.what());
         exit(1);
@@ -41,6 +41,7 @@
 #include <optional>
 // need it for the "size" definitions
 #include <sodium.h>
+#include "Encryption.hpp"
 
 
 /**
@@ -67,14 +68,16 @@ static constexpr const auto SESSION_KEY_ANNOUNCE_DELTA=std::chrono::seconds(1);
 
 // Session key packet
 // Since the size of each session key packet never changes, this memory layout is the easiest
+// NOTE: The encryption mode and cipher are boxed together with the session key (see SessionKeyPlaintext), which changed SIZE_BYTES.
+// A rx / tx from before that change drops the session key packets of a newer tx / rx as invalid - always update both sides together.
 class WBSessionKeyPacket{
 public:
     // note how this member doesn't add up to the size of this class (c++ is so great !)
-    static constexpr auto SIZE_BYTES=1+crypto_box_NONCEBYTES+crypto_aead_chacha20poly1305_KEYBYTES + crypto_box_MACBYTES+1+2;
+    static constexpr auto SIZE_BYTES=1+crypto_box_NONCEBYTES+sizeof(SessionKeyData)+1+2;
 public:
     const uint8_t packet_type=WFB_PACKET_KEY;
     std::array<uint8_t,crypto_box_NONCEBYTES> sessionKeyNonce;  // random data
-    std::array<uint8_t,crypto_aead_chacha20poly1305_KEYBYTES + crypto_box_MACBYTES> sessionKeyData; // encrypted session key
+    SessionKeyData sessionKeyData; // encrypted session key, encryption mode and cipher (see SessionKeyPlaintext)
     uint8_t IS_FEC_ENABLED;
     uint16_t MAX_N_FRAGMENTS_PER_BLOCK=0; //Max n of primary and secondary fragments per block (saves memory on rx)
 }__attribute__ ((packed));